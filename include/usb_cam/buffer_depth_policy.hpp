@@ -0,0 +1,105 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__BUFFER_DEPTH_POLICY_HPP_
+#define USB_CAM__BUFFER_DEPTH_POLICY_HPP_
+
+#include <algorithm>
+#include <cstdint>
+
+
+namespace usb_cam
+{
+
+/// @brief Picks how many buffers to cycle through the driver from how capture keeps up.
+///
+/// Every dequeued buffer is recorded with its sequence number and how long after capture it
+/// was dequeued. At the end of each window of frames the depth grows by one if the driver
+/// skipped sequence numbers, i.e. ran out of buffers to capture into, and otherwise shrinks
+/// by one towards the number of buffers the worst dequeue lag of the window actually needed.
+class BufferDepthPolicy
+{
+public:
+  BufferDepthPolicy(unsigned int min_depth, unsigned int max_depth, unsigned int window)
+  : m_min_depth(min_depth),
+    m_max_depth(std::max(min_depth, max_depth)),
+    m_window(std::max(window, 1u))
+  {}
+
+  /// @brief Record a dequeued buffer
+  /// @param depth the current depth
+  /// @param sequence sequence number the driver gave the buffer
+  /// @param lag_us time between capture and dequeue of the buffer
+  /// @param period_us frame period of the device
+  /// @return the depth to use from now on
+  unsigned int update(
+    unsigned int depth, uint32_t sequence, int64_t lag_us, int64_t period_us)
+  {
+    // The sequence starts over when streaming restarts
+    if (m_has_sequence && sequence > m_last_sequence + 1) {
+      m_skipped_frames += sequence - m_last_sequence - 1;
+    }
+    m_last_sequence = sequence;
+    m_has_sequence = true;
+    m_max_lag_us = std::max(m_max_lag_us, lag_us);
+
+    if (++m_frames < m_window) {
+      return depth;
+    }
+
+    unsigned int new_depth = depth;
+    if (m_skipped_frames > 0) {
+      new_depth = depth + 1;
+    } else if (period_us > 0) {
+      // One buffer being filled, one being read, plus those that waited to be dequeued
+      const int64_t needed = (m_max_lag_us + period_us - 1) / period_us + 2;
+      if (needed < static_cast<int64_t>(depth)) {
+        new_depth = depth - 1;
+      }
+    }
+    m_frames = 0;
+    m_skipped_frames = 0;
+    m_max_lag_us = 0;
+    return std::min(std::max(new_depth, m_min_depth), m_max_depth);
+  }
+
+private:
+  const unsigned int m_min_depth;
+  const unsigned int m_max_depth;
+  const unsigned int m_window;
+  unsigned int m_frames = 0;
+  uint64_t m_skipped_frames = 0;
+  int64_t m_max_lag_us = 0;
+  uint32_t m_last_sequence = 0;
+  bool m_has_sequence = false;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__BUFFER_DEPTH_POLICY_HPP_
@@ -0,0 +1,95 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__CAPABILITY_CACHE_HPP_
+#define USB_CAM__CAPABILITY_CACHE_HPP_
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <string>
+#include <vector>
+
+
+namespace usb_cam
+{
+
+/// @brief A frame interval, or range of intervals, the device supports for a format and size
+typedef struct
+{
+  struct v4l2_fmtdesc format;
+  struct v4l2_frmivalenum v4l2_fmt;
+  /// @brief The size, or range of sizes (`V4L2_FRMSIZE_TYPE_STEPWISE` or
+  /// `V4L2_FRMSIZE_TYPE_CONTINUOUS`), `v4l2_fmt` was enumerated for
+  struct v4l2_frmsizeenum size;
+} capture_format_t;
+
+/// @brief Keeps what a device reports about itself on disk, so that it doesn't have to be
+/// enumerated with dozens of ioctls every time the device is opened.
+///
+/// Entries are keyed by the driver, card, bus info and driver version `VIDIOC_QUERYCAP`
+/// reports, so a different camera, port or kernel driver gets its own entry. Entries that
+/// can't be read, or were written for other structure layouts, are treated as missing.
+class CapabilityCache
+{
+public:
+  /// @param directory where entries are kept, created when the first entry is saved
+  /// @param capability the device's `VIDIOC_QUERYCAP` result
+  CapabilityCache(const std::string & directory, const struct v4l2_capability & capability);
+
+  /// @brief `$XDG_CACHE_HOME/usb_cam`, or `$HOME/.cache/usb_cam`
+  static std::string default_directory();
+
+  bool load_formats(std::vector<capture_format_t> & formats) const;
+  void save_formats(const std::vector<capture_format_t> & formats) const;
+
+  bool load_controls(std::vector<struct v4l2_query_ext_ctrl> & controls) const;
+  void save_controls(const std::vector<struct v4l2_query_ext_ctrl> & controls) const;
+
+  inline const std::string & key() const
+  {
+    return m_key;
+  }
+
+private:
+  template<typename T>
+  bool load(const std::string & kind, std::vector<T> & records) const;
+  template<typename T>
+  void save(const std::string & kind, const std::vector<T> & records) const;
+
+  std::string path(const std::string & kind) const;
+
+  std::string m_directory;
+  std::string m_key;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__CAPABILITY_CACHE_HPP_
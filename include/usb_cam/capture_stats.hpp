@@ -0,0 +1,209 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__CAPTURE_STATS_HPP_
+#define USB_CAM__CAPTURE_STATS_HPP_
+
+#include <linux/videodev2.h>
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace usb_cam
+{
+
+/// @brief Counters of a `CaptureStats` at one point in time
+typedef struct
+{
+  // buffers dequeued from the driver
+  uint64_t frames;
+  // sequence numbers skipped by the driver, i.e. frames it dropped
+  uint64_t driver_dropped_frames;
+  // frames dequeued but never converted, see `latest_frame_only`
+  uint64_t skipped_frames;
+  // frames captured but dropped before publishing because publishing fell behind
+  uint64_t publish_dropped_frames;
+  // buffers the driver flagged with `V4L2_BUF_FLAG_ERROR`
+  uint64_t error_frames;
+  // frames dropped because they could not be decoded or were larger than the driver said
+  uint64_t corrupt_frames;
+  // time from capture until the buffer was dequeued
+  int64_t last_dequeue_lag_us;
+  int64_t max_dequeue_lag_us;
+  // time from dequeuing a frame until it was published
+  int64_t last_publish_lag_us;
+  int64_t max_publish_lag_us;
+  // times the device was lost, see `UsbCam::get_image`
+  uint64_t disconnects;
+  // true from losing the device until it was reopened
+  bool disconnected;
+  // time from losing the device until it was reopened, for the last time it was lost
+  int64_t last_outage_us;
+} capture_stats_t;
+
+/// @brief Frame accounting that can be read from any thread at any time without disturbing
+/// capture. Every counter has a single writer, the capture thread for everything recorded
+/// by `UsbCam` and the publishing thread for `record_publish` and `record_publish_drop`,
+/// so updates are plain relaxed atomic stores and never wait.
+class CaptureStats
+{
+public:
+  CaptureStats() = default;
+  CaptureStats(const CaptureStats &) = delete;
+  CaptureStats & operator=(const CaptureStats &) = delete;
+
+  /// @brief Capture thread only. Record a buffer dequeued from the driver
+  /// @param sequence sequence number the driver gave the buffer
+  /// @param flags flags the driver set on the buffer
+  /// @param lag_us time from capture until the buffer was dequeued
+  void record_dequeue(uint32_t sequence, uint32_t flags, int64_t lag_us)
+  {
+    increment(m_frames);
+    if (m_has_sequence && sequence > m_last_sequence + 1) {
+      add(m_driver_dropped_frames, sequence - m_last_sequence - 1);
+    }
+    m_last_sequence = sequence;
+    m_has_sequence = true;
+    if (flags & V4L2_BUF_FLAG_ERROR) {
+      increment(m_error_frames);
+    }
+    store_lag(m_last_dequeue_lag_us, m_max_dequeue_lag_us, lag_us);
+  }
+
+  /// @brief Capture thread only. Record a dequeued frame that is not converted
+  void record_skip()
+  {
+    increment(m_skipped_frames);
+  }
+
+  /// @brief Capture thread only. Record a dequeued frame dropped because it could not be
+  /// decoded or did not fit its buffer
+  void record_corrupt()
+  {
+    increment(m_corrupt_frames);
+  }
+
+  /// @brief Capture thread only. The driver numbers frames from 0 again once streaming
+  /// restarts, so don't count the jump as dropped frames
+  void restart_sequence()
+  {
+    m_has_sequence = false;
+  }
+
+  /// @brief Capture thread only. Record losing the device
+  void record_disconnect()
+  {
+    increment(m_disconnects);
+    m_disconnected.store(true, std::memory_order_relaxed);
+  }
+
+  /// @brief Capture thread only. Record reopening the device `outage_us` after losing it
+  void record_reconnect(int64_t outage_us)
+  {
+    m_last_outage_us.store(outage_us, std::memory_order_relaxed);
+    m_disconnected.store(false, std::memory_order_relaxed);
+  }
+
+  /// @brief Publishing thread only. Record a frame published `lag_us` after it was dequeued
+  void record_publish(int64_t lag_us)
+  {
+    store_lag(m_last_publish_lag_us, m_max_publish_lag_us, lag_us);
+  }
+
+  /// @brief Record a captured frame dropped because publishing fell behind. Only call from
+  /// the thread that drops frames
+  void record_publish_drop()
+  {
+    increment(m_publish_dropped_frames);
+  }
+
+  /// @brief Any thread. The counters may be a few frames apart from each other
+  capture_stats_t snapshot() const
+  {
+    capture_stats_t stats;
+    stats.frames = m_frames.load(std::memory_order_relaxed);
+    stats.driver_dropped_frames = m_driver_dropped_frames.load(std::memory_order_relaxed);
+    stats.skipped_frames = m_skipped_frames.load(std::memory_order_relaxed);
+    stats.publish_dropped_frames = m_publish_dropped_frames.load(std::memory_order_relaxed);
+    stats.error_frames = m_error_frames.load(std::memory_order_relaxed);
+    stats.corrupt_frames = m_corrupt_frames.load(std::memory_order_relaxed);
+    stats.last_dequeue_lag_us = m_last_dequeue_lag_us.load(std::memory_order_relaxed);
+    stats.max_dequeue_lag_us = m_max_dequeue_lag_us.load(std::memory_order_relaxed);
+    stats.last_publish_lag_us = m_last_publish_lag_us.load(std::memory_order_relaxed);
+    stats.max_publish_lag_us = m_max_publish_lag_us.load(std::memory_order_relaxed);
+    stats.disconnects = m_disconnects.load(std::memory_order_relaxed);
+    stats.disconnected = m_disconnected.load(std::memory_order_relaxed);
+    stats.last_outage_us = m_last_outage_us.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+private:
+  static void increment(std::atomic<uint64_t> & counter)
+  {
+    add(counter, 1);
+  }
+
+  static void add(std::atomic<uint64_t> & counter, uint64_t value)
+  {
+    // Single writer, so no read-modify-write instruction is needed
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  static void store_lag(
+    std::atomic<int64_t> & last, std::atomic<int64_t> & max, int64_t lag_us)
+  {
+    last.store(lag_us, std::memory_order_relaxed);
+    if (lag_us > max.load(std::memory_order_relaxed)) {
+      max.store(lag_us, std::memory_order_relaxed);
+    }
+  }
+
+  std::atomic<uint64_t> m_frames{0};
+  std::atomic<uint64_t> m_driver_dropped_frames{0};
+  std::atomic<uint64_t> m_skipped_frames{0};
+  std::atomic<uint64_t> m_publish_dropped_frames{0};
+  std::atomic<uint64_t> m_error_frames{0};
+  std::atomic<uint64_t> m_corrupt_frames{0};
+  std::atomic<int64_t> m_last_dequeue_lag_us{0};
+  std::atomic<int64_t> m_max_dequeue_lag_us{0};
+  std::atomic<int64_t> m_last_publish_lag_us{0};
+  std::atomic<int64_t> m_max_publish_lag_us{0};
+  std::atomic<uint64_t> m_disconnects{0};
+  std::atomic<bool> m_disconnected{false};
+  std::atomic<int64_t> m_last_outage_us{0};
+
+  // Only touched by the capture thread
+  uint32_t m_last_sequence = 0;
+  bool m_has_sequence = false;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__CAPTURE_STATS_HPP_
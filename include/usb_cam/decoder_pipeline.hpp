@@ -0,0 +1,123 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__DECODER_PIPELINE_HPP_
+#define USB_CAM__DECODER_PIPELINE_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "usb_cam/formats/pixel_format_base.hpp"
+
+
+namespace usb_cam
+{
+
+using usb_cam::formats::pixel_format_base;
+
+
+/// @brief Decode independent (intra-only) frames, e.g. MJPEG, in parallel.
+///
+/// Each slot owns a decoder (a pixel format instance with its own codec context) and a
+/// worker thread. Frames are handed to the slots round-robin as they are captured and
+/// handed back ordered by their V4L2 sequence number, so the output order matches the
+/// capture order.
+///
+/// With `depth` slots a frame is returned `depth - 1` captures after it was submitted,
+/// i.e. the pipeline adds up to `depth - 1` frame periods of latency in exchange for
+/// giving each frame up to `depth` frame periods to decode.
+class DecoderPipeline
+{
+public:
+  /// @param decoders one decoder per slot, never shared between slots
+  /// @param output_size size in bytes of a decoded frame
+  DecoderPipeline(
+    const std::vector<std::shared_ptr<pixel_format_base>> & decoders,
+    const size_t & output_size);
+  ~DecoderPipeline();
+
+  DecoderPipeline(const DecoderPipeline &) = delete;
+  DecoderPipeline & operator=(const DecoderPipeline &) = delete;
+
+  /// @brief Copy a captured frame into the next slot and start decoding it.
+  /// Requires a free slot, i.e. `in_flight() < depth()`.
+  void submit(
+    const char * src, const size_t & bytes_used,
+    const uint32_t & sequence, const timespec & stamp);
+
+  /// @brief Wait for the oldest frame in flight to be decoded and copy it to `dest`
+  /// @return false if no frame was in flight, or if the oldest frame could not be decoded,
+  /// in which case it is dropped and `dest` is left untouched
+  bool pop(char * dest, uint32_t & sequence, timespec & stamp);
+
+  /// @brief Wait for running decodes to finish and drop every frame in flight
+  void flush();
+
+  /// @brief Number of frames submitted and not yet popped
+  size_t in_flight();
+
+  /// @brief Number of slots, i.e. frames decoded in parallel
+  inline size_t depth()
+  {
+    return m_slots.size();
+  }
+
+private:
+  typedef struct
+  {
+    std::shared_ptr<pixel_format_base> decoder;
+    std::vector<char> input;
+    size_t bytes_used;
+    std::vector<char> output;
+    uint32_t sequence;
+    timespec stamp;
+    bool occupied;  // submitted and not yet popped
+    bool decoded;
+    bool converted;  // the decoder accepted the frame, only valid once decoded
+    std::condition_variable work_cv;
+    std::thread thread;
+  } slot_t;
+
+  void worker(slot_t & slot);
+
+  std::vector<std::unique_ptr<slot_t>> m_slots;
+  std::mutex m_mutex;
+  std::condition_variable m_decoded_cv;
+  size_t m_next_slot;
+  bool m_stop;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__DECODER_PIPELINE_HPP_
@@ -0,0 +1,80 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef USB_CAM__DEVICE_WATCHER_HPP_
+#define USB_CAM__DEVICE_WATCHER_HPP_
+
+#include <string>
+
+
+namespace usb_cam
+{
+
+/// @brief Notices a device node (re)appearing without polling, by watching the directory
+/// that holds it with inotify.
+///
+/// The kernel creates the node as soon as the device enumerates and udev then sets its
+/// owner and permissions, so both creation and attribute changes are reported. Symlinks
+/// such as `/dev/v4l/by-id/...` are reported when udev creates them. If the directory can't
+/// be watched, e.g. because it was removed together with the last device in it, nothing is
+/// ever reported and the caller has to fall back to retrying periodically.
+class DeviceWatcher
+{
+public:
+  explicit DeviceWatcher(const std::string & device_path);
+  ~DeviceWatcher();
+
+  DeviceWatcher(const DeviceWatcher &) = delete;
+  DeviceWatcher & operator=(const DeviceWatcher &) = delete;
+
+  /// @brief Readable while events are pending, to wait for it with `poll` or `epoll`
+  inline int fd() const
+  {
+    return m_fd;
+  }
+
+  /// @brief True if the directory is watched
+  inline bool is_watching() const
+  {
+    return m_watch != -1;
+  }
+
+  /// @brief Read all pending events without blocking
+  /// @return true if any of them concerned the device node, or may have been missed
+  bool consume();
+
+private:
+  int m_fd;
+  int m_watch;
+  /// @brief Name of the device node within the watched directory
+  std::string m_name;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__DEVICE_WATCHER_HPP_
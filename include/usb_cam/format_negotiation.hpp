@@ -0,0 +1,80 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__FORMAT_NEGOTIATION_HPP_
+#define USB_CAM__FORMAT_NEGOTIATION_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "usb_cam/capability_cache.hpp"
+
+
+namespace usb_cam
+{
+
+/// @brief Usable payload of a USB 2.0 high speed isochronous endpoint, 3 transactions of
+/// 1024 bytes per 125 us microframe, in bytes per second
+constexpr double USB2_ISOCHRONOUS_BANDWIDTH = 3 * 1024 * 8000.0;
+
+/// @brief A way of capturing and converting frames, as chosen by `choose_pixel_format`
+typedef struct
+{
+  // `pixel_format` parameter value, e.g. "mjpeg2rgb"
+  std::string pixel_format_name;
+  // encoding of the published images
+  std::string output_encoding;
+  // highest frame rate the device reports for the requested size
+  double frame_rate;
+  // bytes per second on the bus at the requested frame rate
+  double bandwidth;
+  // relative conversion cost per second at the requested frame rate, see `choose_pixel_format`
+  double cpu_cost;
+  // why it was chosen, for logging
+  std::string reason;
+} format_choice_t;
+
+/// @brief Pick the pixel format with the lowest conversion cost that captures images of
+/// `width` x `height` at `framerate` or more, within `usb_bandwidth`.
+///
+/// The cost model estimates, for every capture format and conversion, the bytes per pixel
+/// sent over the bus and the CPU time per pixel spent converting to the output encoding.
+/// Uncompressed formats are rarely offered at frame rates the bus can't carry, but another
+/// device on the same bus or a USB 3 camera on a USB 2 port makes the bandwidth the limit.
+/// Color (rgb8) output is preferred over mono output whenever a color format qualifies.
+/// If no format qualifies, the one with the highest frame rate at `width` x `height` is used.
+/// @throws std::invalid_argument if no supported format is available at that size
+format_choice_t choose_pixel_format(
+  const std::vector<capture_format_t> & formats, int width, int height, int framerate,
+  double usb_bandwidth = USB2_ISOCHRONOUS_BANDWIDTH);
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__FORMAT_NEGOTIATION_HPP_
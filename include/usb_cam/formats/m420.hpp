@@ -59,13 +59,14 @@ public:
   {}
 
   /// @brief Convert a YUV420 (aka M420) image to RGB8
-  void convert(const char * & src, char * & dest, const int & bytes_used) override
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
   {
     (void)bytes_used;    // not used by this conversion method
     cv::Size size(m_height, m_width);
     const cv::Mat cv_img(m_height, m_width, CV_8UC1, const_cast<char *>(src));
     cv::Mat cv_out(m_height, m_width, CV_8UC3, dest);
     cv::cvtColor(cv_img, cv_out, cv::COLOR_YUV420p2RGB);
+    return true;
   }
 
 private:
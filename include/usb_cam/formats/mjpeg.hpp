@@ -36,7 +36,13 @@
 /// https://www.ffmpeg.org/doxygen/4.0/decode__video_8c_source.html
 ///
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 
 
 extern "C" {
@@ -49,7 +55,6 @@ extern "C" {
 #include "libswscale/swscale.h"
 }
 
-#include "usb_cam/usb_cam.hpp"
 #include "usb_cam/formats/pixel_format_base.hpp"
 #include "usb_cam/formats/utils.hpp"
 
@@ -59,21 +64,45 @@ namespace usb_cam
 namespace formats
 {
 
-class MJPEG2RGB : public pixel_format_base
+/// @brief Publish the MJPEG frames as captured, without decoding them. Every frame is a
+/// complete JPEG image, so it can be published as a compressed image as is.
+class MJPEG : public pixel_format_base
 {
 public:
-  MJPEG2RGB(const int & width, const int & height)
+  MJPEG()
   : pixel_format_base(
-      "mjpeg2rgb",
+      "mjpeg",
       V4L2_PIX_FMT_MJPEG,
-      usb_cam::constants::RGB8,
-      3,
+      usb_cam::constants::JPEG,
+      3,  // initial buffer size only, grown to what the driver reports once the format is set
       8,
-      true),
+      false)
+  {}
+};
+
+/// @brief Common MJPEG decoding for the formats converting MJPEG frames to raw images.
+///
+/// With a `decode_scale` of 2, 4 or 8 libavcodec only decodes the low frequency DCT
+/// coefficients of each block (`lowres`), producing an image that is that many times
+/// smaller in each dimension at a fraction of the cost of a full decode.
+class mjpeg_decoder_base : public pixel_format_base
+{
+public:
+  /// @param width width of the captured frames
+  /// @param height height of the captured frames
+  /// @param decode_scale one of 1, 2, 4 or 8, see `decode_scale()`
+  /// @param codec_flags `AV_CODEC_FLAG_*` flags to decode with
+  mjpeg_decoder_base(
+    std::string name, std::string ros, uint8_t channels,
+    const int & width, const int & height, const int & decode_scale, const int & codec_flags)
+  : pixel_format_base(name, V4L2_PIX_FMT_MJPEG, ros, channels, 8, true),
+    m_decode_scale(decode_scale),
+    m_lowres(lowres_from_scale(decode_scale)),
+    m_width((width + decode_scale - 1) / decode_scale),
+    m_height((height + decode_scale - 1) / decode_scale),
+    m_avframe_device(av_frame_alloc()),
     m_avcodec(avcodec_find_decoder(AVCodecID::AV_CODEC_ID_MJPEG)),
     m_avparser(av_parser_init(AVCodecID::AV_CODEC_ID_MJPEG)),
-    m_avframe_device(av_frame_alloc()),
-    m_avframe_rgb(av_frame_alloc()),
     m_avoptions(NULL),
     m_avpacket(av_packet_alloc()),
     m_averror_str(reinterpret_cast<char *>(malloc(AV_ERROR_MAX_STRING_SIZE)))
@@ -81,6 +110,11 @@ public:
     if (!m_avcodec) {
       throw std::runtime_error("Could not find MJPEG decoder");
     }
+    if (m_lowres > m_avcodec->max_lowres) {
+      throw std::invalid_argument(
+              "MJPEG decoder does not support a decode_scale of " +
+              std::to_string(decode_scale));
+    }
 
     if (!m_avparser) {
       throw std::runtime_error("Could not find MJPEG parser");
@@ -91,19 +125,10 @@ public:
 
     m_avcodec_context = avcodec_alloc_context3(m_avcodec);
 
-    m_avframe_device->width = width;
-    m_avframe_device->height = height;
+    m_avframe_device->width = m_width;
+    m_avframe_device->height = m_height;
     m_avframe_device->format = AV_PIX_FMT_YUV422P;
 
-    m_avframe_rgb->width = width;
-    m_avframe_rgb->height = height;
-    m_avframe_rgb->format = AV_PIX_FMT_RGB24;
-
-    m_sws_context = sws_getContext(
-      width, height, (AVPixelFormat)m_avframe_device->format,
-      width, height, AV_PIX_FMT_RGB24, SWS_FAST_BILINEAR,
-      NULL, NULL, NULL);
-
     // Suppress warnings from ffmpeg libraries to avoid spamming the console
     av_log_set_level(AV_LOG_FATAL);
     av_log_set_flags(AV_LOG_SKIP_REPEATED);
@@ -113,37 +138,17 @@ public:
     m_avcodec_context->height = height;
     m_avcodec_context->pix_fmt = (AVPixelFormat)m_avframe_device->format;
     m_avcodec_context->codec_type = AVMEDIA_TYPE_VIDEO;
-
-    m_avframe_device_size = static_cast<size_t>(
-      av_image_get_buffer_size(
-        (AVPixelFormat)m_avframe_device->format,
-        m_avframe_device->width,
-        m_avframe_device->height,
-        m_align));
-    m_avframe_rgb_size = static_cast<size_t>(
-      av_image_get_buffer_size(
-        (AVPixelFormat)m_avframe_rgb->format,
-        m_avframe_rgb->width,
-        m_avframe_rgb->height,
-        m_align));
+    m_avcodec_context->lowres = m_lowres;
+    m_avcodec_context->flags |= codec_flags;
 
     // Initialize AVCodecContext
     if (avcodec_open2(m_avcodec_context, m_avcodec, &m_avoptions) < 0) {
       throw std::runtime_error("Could not open decoder");
       return;
     }
-
-    m_result = av_frame_get_buffer(m_avframe_device, m_align);
-    if (m_result != 0) {
-      print_av_error_string(m_result);
-    }
-    m_result = av_frame_get_buffer(m_avframe_rgb, m_align);
-    if (m_result != 0) {
-      print_av_error_string(m_result);
-    }
   }
 
-  ~MJPEG2RGB()
+  virtual ~mjpeg_decoder_base()
   {
     if (m_avcodec_context) {
       avcodec_close(m_avcodec_context);
@@ -152,39 +157,32 @@ public:
     if (m_avframe_device) {
       av_frame_free(&m_avframe_device);
     }
-    if (m_avframe_rgb) {
-      av_frame_free(&m_avframe_rgb);
-    }
     if (m_avpacket) {
-      av_packet_unref(m_avpacket);
+      // The packet only ever borrows the V4L2 buffer, never free it
+      m_avpacket->data = NULL;
+      m_avpacket->size = 0;
       av_packet_free(&m_avpacket);
     }
     if (m_avparser) {
       av_parser_close(m_avparser);
     }
-
-    if (m_sws_context) {
-      sws_freeContext(m_sws_context);
-    }
+    free(m_averror_str);
   }
 
-  void convert(const char * & src, char * & dest, const int & bytes_used) override
+  /// @brief Factor the decoded image is downscaled by, see the class description
+  int decode_scale() override {return m_decode_scale;}
+
+protected:
+  /// @brief Decode an MJPEG frame into `m_avframe_device`.
+  /// The packet is reused for every frame and points at the V4L2 buffer, no copies.
+  /// @return true if `m_avframe_device` holds the decoded frame
+  bool decode(const char * src, const int & bytes_used)
   {
     m_result = 0;
-    // clear the picture
-    memset(dest, 0, m_avframe_device_size);
 
-    #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 133, 100)
-    // deprecated: https://github.com/FFmpeg/FFmpeg/commit/f7db77bd8785d1715d3e7ed7e69bd1cc991f2d07
-    av_init_packet(m_avpacket);
-    #else
-    av_new_packet(m_avpacket, bytes_used);
-    #endif
-
-    av_packet_from_data(
-      m_avpacket,
-      const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(src)),
-      bytes_used);
+    // Not reference counted, so libavcodec won't try to take ownership of the V4L2 buffer
+    m_avpacket->data = const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(src));
+    m_avpacket->size = bytes_used;
 
     // Pass src MJPEG image to decoder
     m_result = avcodec_send_packet(m_avcodec_context, m_avpacket);
@@ -193,30 +191,47 @@ public:
     if (m_result != 0) {
       std::cerr << "Failed to send AVPacket to decode: ";
       print_av_error_string(m_result);
+      return false;
     }
 
     m_result = avcodec_receive_frame(m_avcodec_context, m_avframe_device);
 
     if (m_result == AVERROR(EAGAIN) || m_result == AVERROR_EOF) {
-      return;
+      return false;
     } else if (m_result < 0) {
       std::cerr << "Failed to recieve decoded frame from codec: ";
       print_av_error_string(m_result);
+      return false;
     }
+    return true;
+  }
 
-    sws_scale(
-      m_sws_context, m_avframe_device->data,
-      m_avframe_device->linesize, 0, m_avframe_device->height,
-      m_avframe_rgb->data, m_avframe_rgb->linesize);
+  int m_decode_scale;
+  int m_lowres;
+  /// @brief Size of the decoded image
+  int m_width;
+  int m_height;
+  AVFrame * m_avframe_device;
 
-    av_image_copy_to_buffer(
-      const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(dest)),
-      m_avframe_rgb_size, m_avframe_rgb->data,
-      m_avframe_rgb->linesize, (AVPixelFormat)m_avframe_rgb->format,
-      m_avframe_rgb->width, m_avframe_rgb->height, m_align);
+private:
+  /// @brief Map a decode scale to libavcodec's `lowres`, i.e. log2 of the scale
+  static int lowres_from_scale(const int & decode_scale)
+  {
+    switch (decode_scale) {
+      case 1:
+        return 0;
+      case 2:
+        return 1;
+      case 4:
+        return 2;
+      case 8:
+        return 3;
+      default:
+        throw std::invalid_argument(
+                "decode_scale must be 1, 2, 4 or 8, got " + std::to_string(decode_scale));
+    }
   }
 
-private:
   void print_av_error_string(int & err_code)
   {
     av_make_error_string(m_averror_str, AV_ERROR_MAX_STRING_SIZE, err_code);
@@ -226,19 +241,171 @@ private:
   AVCodec * m_avcodec;
   AVCodecContext * m_avcodec_context;
   AVCodecParserContext * m_avparser;
-  AVFrame * m_avframe_device;
-  AVFrame * m_avframe_rgb;
   AVDictionary * m_avoptions;
   AVPacket * m_avpacket;
-  SwsContext * m_sws_context;
-  size_t m_avframe_device_size;
-  size_t m_avframe_rgb_size;
   char * m_averror_str;
   int m_result = 0;
-  int m_counter = 0;
-  const int * m_linesize;
+};
+
+/// @brief Decode MJPEG frames to RGB8.
+///
+/// The layout of the decoded frames depends on the chroma subsampling the camera encodes
+/// with (4:2:0, 4:2:2, ...), so the swscale context is created from the first decoded
+/// frame rather than up front, and kept for as long as the frames look the same.
+class MJPEG2RGB : public mjpeg_decoder_base
+{
+public:
+  /// @param width width of the captured frames
+  /// @param height height of the captured frames
+  /// @param decode_scale one of 1, 2, 4 or 8, see `mjpeg_decoder_base`
+  MJPEG2RGB(const int & width, const int & height, const int & decode_scale = 1)
+  : mjpeg_decoder_base(
+      "mjpeg2rgb", usb_cam::constants::RGB8, 3, width, height, decode_scale, 0),
+    m_sws_context(NULL)
+  {}
+
+  ~MJPEG2RGB()
+  {
+    for (auto & cached : m_sws_contexts) {
+      sws_freeContext(cached.second);
+    }
+  }
+
+  /// @brief Decode an MJPEG frame and color convert it straight into `dest`.
+  /// swscale writes directly into `dest`: one decode and one conversion, no extra copies.
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
+  {
+    if (!decode(src, bytes_used) || !update_sws_context()) {
+      return false;
+    }
+
+    // Describe `dest` as a packed RGB24 image with no row padding
+    av_image_fill_arrays(
+      m_dest_data, m_dest_linesize,
+      reinterpret_cast<const uint8_t *>(dest), AV_PIX_FMT_RGB24, m_width, m_height, 1);
+
+    sws_scale(
+      m_sws_context, m_avframe_device->data,
+      m_avframe_device->linesize, 0, m_avframe_device->height,
+      m_dest_data, m_dest_linesize);
+    return true;
+  }
+
+private:
+  /// @brief Source format, width, height and destination format of a swscale context
+  typedef std::tuple<int, int, int, int> sws_key_t;
+
+  /// @brief Flags for the fastest conversion. No SWS_ACCURATE_RND, SWS_BITEXACT or
+  /// SWS_FULL_CHR_H_INT, any of which rules out swscale's optimized YUV to RGB paths.
+  static constexpr int sws_flags = SWS_FAST_BILINEAR;
+
+  /// @brief Point `m_sws_context` at the context converting the frame in
+  /// `m_avframe_device`, creating and caching it the first time such a frame is seen
+  /// @return false if swscale can not convert the decoded frame
+  bool update_sws_context()
+  {
+    const sws_key_t key(
+      m_avframe_device->format, m_avframe_device->width, m_avframe_device->height,
+      AV_PIX_FMT_RGB24);
+    if (m_sws_context && key == m_sws_key) {
+      return true;
+    }
+
+    auto cached = m_sws_contexts.find(key);
+    if (cached == m_sws_contexts.end()) {
+      // The deprecated YUVJ formats are the plain YUV formats in full range, give swscale
+      // the plain format and the range explicitly to stay on its optimized paths
+      bool full_range = m_avframe_device->color_range == AVCOL_RANGE_JPEG;
+      const AVPixelFormat src_format = without_jpeg_range(
+        static_cast<AVPixelFormat>(m_avframe_device->format), full_range);
+
+      SwsContext * sws_context = sws_getContext(
+        m_avframe_device->width, m_avframe_device->height, src_format,
+        m_width, m_height, AV_PIX_FMT_RGB24, sws_flags,
+        NULL, NULL, NULL);
+      if (!sws_context) {
+        std::cerr << "Unable to convert decoded MJPEG frames of format " <<
+          m_avframe_device->format << " to RGB8" << std::endl;
+        return false;
+      }
+      if (full_range) {
+        const int * coefficients = sws_getCoefficients(SWS_CS_DEFAULT);
+        sws_setColorspaceDetails(
+          sws_context, coefficients, 1, coefficients, 1, 0, 1 << 16, 1 << 16);
+      }
+      cached = m_sws_contexts.emplace(key, sws_context).first;
+    }
+
+    m_sws_key = key;
+    m_sws_context = cached->second;
+    return true;
+  }
+
+  /// @brief Map a YUVJ pixel format to its YUV equivalent
+  /// @param full_range set to true if `format` was a YUVJ format
+  static AVPixelFormat without_jpeg_range(const AVPixelFormat & format, bool & full_range)
+  {
+    switch (format) {
+      case AV_PIX_FMT_YUVJ420P:
+        full_range = true;
+        return AV_PIX_FMT_YUV420P;
+      case AV_PIX_FMT_YUVJ422P:
+        full_range = true;
+        return AV_PIX_FMT_YUV422P;
+      case AV_PIX_FMT_YUVJ444P:
+        full_range = true;
+        return AV_PIX_FMT_YUV444P;
+      case AV_PIX_FMT_YUVJ440P:
+        full_range = true;
+        return AV_PIX_FMT_YUV440P;
+      case AV_PIX_FMT_YUVJ411P:
+        full_range = true;
+        return AV_PIX_FMT_YUV411P;
+      default:
+        return format;
+    }
+  }
+
+  std::map<sws_key_t, SwsContext *> m_sws_contexts;
+  /// @brief Context used for the last frame, saves the lookup while frames don't change
+  SwsContext * m_sws_context;
+  sws_key_t m_sws_key;
+  uint8_t * m_dest_data[4];
+  int m_dest_linesize[4];
+};
+
+/// @brief Decode MJPEG frames to MONO8.
+///
+/// JPEG stores luma in its own plane, so the decoded Y plane already is the grayscale
+/// image: chroma decoding is skipped (`AV_CODEC_FLAG_GRAY`) and the Y plane is copied
+/// row by row, no color conversion.
+class MJPEG2MONO8 : public mjpeg_decoder_base
+{
+public:
+  /// @param width width of the captured frames
+  /// @param height height of the captured frames
+  /// @param decode_scale one of 1, 2, 4 or 8, see `mjpeg_decoder_base`
+  MJPEG2MONO8(const int & width, const int & height, const int & decode_scale = 1)
+  : mjpeg_decoder_base(
+      "mjpeg2mono8", usb_cam::constants::MONO8, 1, width, height, decode_scale,
+      AV_CODEC_FLAG_GRAY)
+  {}
+
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
+  {
+    if (!decode(src, bytes_used)) {
+      return false;
+    }
 
-  const int m_align = 32;
+    // The decoded rows are padded, `dest` is not
+    const uint8_t * luma = m_avframe_device->data[0];
+    const int rows = std::min(m_height, m_avframe_device->height);
+    const int columns = std::min(m_width, m_avframe_device->width);
+    for (int row = 0; row < rows; ++row) {
+      memcpy(dest + row * m_width, luma + row * m_avframe_device->linesize[0], columns);
+    }
+    return true;
+  }
 };
 
 }  // namespace formats
@@ -90,11 +90,23 @@ public:
   /// @param src pointer to source Y10 (MONO10) image
   /// @param dest pointer to destination MONO8 image
   /// @param bytes_used number of bytes used by source image
-  void convert(const char * & src, char * & dest, const int & bytes_used) override
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
   {
     (void)bytes_used;  // not used by this conversion method
-    int i, j;
-    for (i = 0, j = 0; i < (m_number_of_pixels << 1); i += 2, j += 1) {
+    convert_band(src, dest, 0, m_number_of_pixels);
+    return true;
+  }
+
+  bool is_band_splittable() override {return true;}
+
+  void convert_band(
+    const char * src, char * dest,
+    const size_t & first_pixel, const size_t & number_of_pixels) override
+  {
+    size_t i, j;
+    for (i = 2 * first_pixel, j = first_pixel; j < first_pixel + number_of_pixels;
+      i += 2, j += 1)
+    {
       // first byte is low byte, second byte is high byte; smash together and convert to 8-bit
       dest[j] = (unsigned char)(((src[i + 0] >> 2) & 0x3F) | ((src[i + 1] << 6) & 0xC0));
     }
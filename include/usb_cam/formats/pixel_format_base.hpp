@@ -86,13 +86,40 @@ public:
   inline bool requires_conversion() {return m_requires_conversion;}
 
   /// @brief Conversion method. Meant to be overridden if pixel format requires it.
-  virtual void convert(const char * & src, char * & dest, const int & bytes_used)
+  /// @return false if `src` could not be converted, in which case `dest` is left untouched
+  virtual bool convert(const char * & src, char * & dest, const int & bytes_used)
   {
     // provide default implementation so derived classes do not have to implement
     // this method if not required
     (void)src;
     (void)dest;
     (void)bytes_used;
+    return true;
+  }
+
+  /// @brief Factor by which the output image is smaller than the captured image in each
+  /// dimension, rounding up. Only formats that decode at a reduced resolution override this.
+  /// @return
+  virtual int decode_scale() {return 1;}
+
+  /// @brief True if this format implements `convert_band`, i.e. a frame can be converted
+  /// as independent bands of rows. Used in the usb_cam library logic to spread the
+  /// conversion of a single frame across the conversion thread pool.
+  /// @return
+  virtual bool is_band_splittable() {return false;}
+
+  /// @brief Convert a band of `number_of_pixels` pixels starting at `first_pixel`.
+  /// `src` and `dest` point to the start of the whole frame. Bands handed out by the
+  /// usb_cam library always start and end on a row boundary and never overlap, so this
+  /// must be safe to call concurrently for different bands of the same frame.
+  virtual void convert_band(
+    const char * src, char * dest,
+    const size_t & first_pixel, const size_t & number_of_pixels)
+  {
+    (void)src;
+    (void)dest;
+    (void)first_pixel;
+    (void)number_of_pixels;
   }
 
   /// @brief Returns if the final output format is color
@@ -142,6 +169,15 @@ public:
       m_ros == usb_cam::constants::BAYER_GRBG16;
   }
 
+  /// @brief Returns if the final output format is compressed. Compressed frames vary in
+  /// size, only the first `bytes_used` bytes of the output hold the frame, and they are
+  /// published as a sensor_msgs/CompressedImage rather than a sensor_msgs/Image
+  /// @return
+  inline bool is_compressed()
+  {
+    return m_ros == usb_cam::constants::JPEG;
+  }
+
   /// @brief Returns if the final output format has an alpha value
   /// Copied from:
   ///     https://github.com/ros2/common_interfaces/blob/rolling/sensor_msgs/include/sensor_msgs/image_encodings.hpp
@@ -0,0 +1,310 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__FORMATS__SIMD_HPP_
+#define USB_CAM__FORMATS__SIMD_HPP_
+
+#if defined(__x86_64__) || defined(__i386__)
+#define USB_CAM_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#include "usb_cam/formats/utils.hpp"
+
+
+namespace usb_cam
+{
+namespace formats
+{
+
+
+/// @brief Instruction set used by the vectorized conversion kernels
+typedef enum
+{
+  SIMD_LEVEL_SCALAR,
+  SIMD_LEVEL_SSE41,
+  SIMD_LEVEL_AVX2,
+} simd_level_t;
+
+
+/// @brief Best instruction set supported by the CPU we are running on.
+/// The CPUID query is done once and cached for the lifetime of the process.
+inline simd_level_t get_simd_level()
+{
+  static const simd_level_t level = []() {
+#ifdef USB_CAM_SIMD_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+        return SIMD_LEVEL_AVX2;
+      }
+      if (__builtin_cpu_supports("sse4.1")) {
+        return SIMD_LEVEL_SSE41;
+      }
+#endif
+      return SIMD_LEVEL_SCALAR;
+    }();
+  return level;
+}
+
+
+/// @brief Byte offset of each component within a packed 4:2:2 macropixel
+/// (four bytes holding two pixels which share one pair of chroma samples).
+template<int Y0, int U, int Y1, int V>
+struct yuv422_order
+{
+  static constexpr int y0 = Y0;
+  static constexpr int u = U;
+  static constexpr int y1 = Y1;
+  static constexpr int v = V;
+};
+
+/// @brief V4L2_PIX_FMT_YUYV (aka YUY2)
+typedef yuv422_order<0, 1, 2, 3> yuyv_order;
+/// @brief V4L2_PIX_FMT_UYVY
+typedef yuv422_order<1, 0, 3, 2> uyvy_order;
+/// @brief V4L2_PIX_FMT_YVYU
+typedef yuv422_order<0, 3, 2, 1> yvyu_order;
+
+
+/// @brief Reference packed 4:2:2 to RGB8 conversion, two pixels per iteration.
+/// The vectorized kernels below fall back to this for the tail of the image.
+template<typename Order>
+inline void yuv422_to_rgb_scalar(
+  const unsigned char * src, unsigned char * dest, const int & number_of_pixels)
+{
+  int i, j;
+  unsigned char y0, y1, u, v;
+  unsigned char r, g, b;
+
+  /// Total number of bytes should be 2 * number of pixels. Achieve this by bit-shifting
+  /// (NumPixels << 1).
+  for (i = 0, j = 0; i < (number_of_pixels << 1); i += 4, j += 6) {
+    y0 = src[i + Order::y0];
+    u = src[i + Order::u];
+    y1 = src[i + Order::y1];
+    v = src[i + Order::v];
+    YUV2RGB(y0, u, v, &r, &g, &b);
+    dest[j + 0] = r;
+    dest[j + 1] = g;
+    dest[j + 2] = b;
+    YUV2RGB(y1, u, v, &r, &g, &b);
+    dest[j + 3] = r;
+    dest[j + 4] = g;
+    dest[j + 5] = b;
+  }
+}
+
+#ifdef USB_CAM_SIMD_X86
+
+/// @brief Shuffle zero-extending the component at `Offset` of four macropixels
+/// into four 32 bit lanes
+template<int Offset>
+__attribute__((target("sse4.1")))
+inline __m128i yuv422_component_shuffle()
+{
+  return _mm_setr_epi8(
+    Offset, -1, -1, -1, 4 + Offset, -1, -1, -1,
+    8 + Offset, -1, -1, -1, 12 + Offset, -1, -1, -1);
+}
+
+/// @brief SSE4.1 packed 4:2:2 to RGB8 conversion, eight pixels per iteration.
+///
+/// Uses the same fixed point arithmetic as `YUV2RGB` on 32 bit lanes, and the
+/// saturating packs reproduce `CLIPVALUE`, so the output is bit-identical to
+/// `yuv422_to_rgb_scalar`. Only the input shuffles depend on `Order`.
+template<typename Order>
+__attribute__((target("sse4.1")))
+inline void yuv422_to_rgb_sse41(
+  const unsigned char * src, unsigned char * dest, const int & number_of_pixels)
+{
+  const __m128i shuffle_y0 = yuv422_component_shuffle<Order::y0>();
+  const __m128i shuffle_u = yuv422_component_shuffle<Order::u>();
+  const __m128i shuffle_y1 = yuv422_component_shuffle<Order::y1>();
+  const __m128i shuffle_v = yuv422_component_shuffle<Order::v>();
+  // Interleave planar [R0..R7 G0..G7] and [B0..B7 ...] into packed RGB
+  const __m128i shuffle_rg_lo = _mm_setr_epi8(
+    0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+  const __m128i shuffle_b_lo = _mm_setr_epi8(
+    -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+  const __m128i shuffle_rg_hi = _mm_setr_epi8(
+    13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i shuffle_b_hi = _mm_setr_epi8(
+    -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i offset = _mm_set1_epi32(128);
+
+  int i = 0;
+
+  for (; i + 8 <= number_of_pixels; i += 8) {
+    const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+
+    const __m128i y0 = _mm_shuffle_epi8(packed, shuffle_y0);
+    const __m128i y1 = _mm_shuffle_epi8(packed, shuffle_y1);
+    const __m128i u = _mm_sub_epi32(_mm_shuffle_epi8(packed, shuffle_u), offset);
+    const __m128i v = _mm_sub_epi32(_mm_shuffle_epi8(packed, shuffle_v), offset);
+
+    // See `YUV2RGB` for the origin of these coefficients
+    const __m128i r_diff = _mm_srai_epi32(_mm_mullo_epi32(v, _mm_set1_epi32(37221)), 15);
+    const __m128i g_diff = _mm_srai_epi32(
+      _mm_add_epi32(
+        _mm_mullo_epi32(u, _mm_set1_epi32(12975)),
+        _mm_mullo_epi32(v, _mm_set1_epi32(18949))), 15);
+    const __m128i b_diff = _mm_srai_epi32(_mm_mullo_epi32(u, _mm_set1_epi32(66883)), 15);
+
+    // Even pixels use y0 and odd pixels use y1, unpack them back into pixel order
+    const __m128i r0 = _mm_add_epi32(y0, r_diff);
+    const __m128i r1 = _mm_add_epi32(y1, r_diff);
+    const __m128i g0 = _mm_sub_epi32(y0, g_diff);
+    const __m128i g1 = _mm_sub_epi32(y1, g_diff);
+    const __m128i b0 = _mm_add_epi32(y0, b_diff);
+    const __m128i b1 = _mm_add_epi32(y1, b_diff);
+    const __m128i r = _mm_packs_epi32(_mm_unpacklo_epi32(r0, r1), _mm_unpackhi_epi32(r0, r1));
+    const __m128i g = _mm_packs_epi32(_mm_unpacklo_epi32(g0, g1), _mm_unpackhi_epi32(g0, g1));
+    const __m128i b = _mm_packs_epi32(_mm_unpacklo_epi32(b0, b1), _mm_unpackhi_epi32(b0, b1));
+
+    // Unsigned saturation clips to [0, 255], same as `CLIPVALUE`
+    const __m128i rg = _mm_packus_epi16(r, g);
+    const __m128i bb = _mm_packus_epi16(b, b);
+
+    const __m128i rgb_lo = _mm_or_si128(
+      _mm_shuffle_epi8(rg, shuffle_rg_lo), _mm_shuffle_epi8(bb, shuffle_b_lo));
+    const __m128i rgb_hi = _mm_or_si128(
+      _mm_shuffle_epi8(rg, shuffle_rg_hi), _mm_shuffle_epi8(bb, shuffle_b_hi));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 3 * i), rgb_lo);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 3 * i + 16), rgb_hi);
+  }
+
+  yuv422_to_rgb_scalar<Order>(src + 2 * i, dest + 3 * i, number_of_pixels - i);
+}
+
+/// @brief AVX2 packed 4:2:2 to RGB8 conversion, sixteen pixels per iteration
+///
+/// AVX2 shuffles and packs operate on each 128 bit lane independently, so this is the
+/// SSE4.1 kernel widened to two lanes, each producing 24 bytes of output.
+template<typename Order>
+__attribute__((target("avx2")))
+inline void yuv422_to_rgb_avx2(
+  const unsigned char * src, unsigned char * dest, const int & number_of_pixels)
+{
+  const __m256i shuffle_y0 = _mm256_broadcastsi128_si256(yuv422_component_shuffle<Order::y0>());
+  const __m256i shuffle_u = _mm256_broadcastsi128_si256(yuv422_component_shuffle<Order::u>());
+  const __m256i shuffle_y1 = _mm256_broadcastsi128_si256(yuv422_component_shuffle<Order::y1>());
+  const __m256i shuffle_v = _mm256_broadcastsi128_si256(yuv422_component_shuffle<Order::v>());
+  const __m256i shuffle_rg_lo = _mm256_broadcastsi128_si256(
+    _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5));
+  const __m256i shuffle_b_lo = _mm256_broadcastsi128_si256(
+    _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1));
+  const __m256i shuffle_rg_hi = _mm256_broadcastsi128_si256(
+    _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+  const __m256i shuffle_b_hi = _mm256_broadcastsi128_si256(
+    _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1));
+  const __m256i offset = _mm256_set1_epi32(128);
+
+  int i = 0;
+
+  for (; i + 16 <= number_of_pixels; i += 16) {
+    const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 2 * i));
+
+    const __m256i y0 = _mm256_shuffle_epi8(packed, shuffle_y0);
+    const __m256i y1 = _mm256_shuffle_epi8(packed, shuffle_y1);
+    const __m256i u = _mm256_sub_epi32(_mm256_shuffle_epi8(packed, shuffle_u), offset);
+    const __m256i v = _mm256_sub_epi32(_mm256_shuffle_epi8(packed, shuffle_v), offset);
+
+    const __m256i r_diff = _mm256_srai_epi32(
+      _mm256_mullo_epi32(v, _mm256_set1_epi32(37221)), 15);
+    const __m256i g_diff = _mm256_srai_epi32(
+      _mm256_add_epi32(
+        _mm256_mullo_epi32(u, _mm256_set1_epi32(12975)),
+        _mm256_mullo_epi32(v, _mm256_set1_epi32(18949))), 15);
+    const __m256i b_diff = _mm256_srai_epi32(
+      _mm256_mullo_epi32(u, _mm256_set1_epi32(66883)), 15);
+
+    const __m256i r0 = _mm256_add_epi32(y0, r_diff);
+    const __m256i r1 = _mm256_add_epi32(y1, r_diff);
+    const __m256i g0 = _mm256_sub_epi32(y0, g_diff);
+    const __m256i g1 = _mm256_sub_epi32(y1, g_diff);
+    const __m256i b0 = _mm256_add_epi32(y0, b_diff);
+    const __m256i b1 = _mm256_add_epi32(y1, b_diff);
+    const __m256i r = _mm256_packs_epi32(
+      _mm256_unpacklo_epi32(r0, r1), _mm256_unpackhi_epi32(r0, r1));
+    const __m256i g = _mm256_packs_epi32(
+      _mm256_unpacklo_epi32(g0, g1), _mm256_unpackhi_epi32(g0, g1));
+    const __m256i b = _mm256_packs_epi32(
+      _mm256_unpacklo_epi32(b0, b1), _mm256_unpackhi_epi32(b0, b1));
+
+    const __m256i rg = _mm256_packus_epi16(r, g);
+    const __m256i bb = _mm256_packus_epi16(b, b);
+
+    const __m256i rgb_lo = _mm256_or_si256(
+      _mm256_shuffle_epi8(rg, shuffle_rg_lo), _mm256_shuffle_epi8(bb, shuffle_b_lo));
+    const __m256i rgb_hi = _mm256_or_si256(
+      _mm256_shuffle_epi8(rg, shuffle_rg_hi), _mm256_shuffle_epi8(bb, shuffle_b_hi));
+
+    // Lane 0 holds pixels 0-7, lane 1 holds pixels 8-15
+    unsigned char * out = dest + 3 * i;
+    _mm_storeu_si128(
+      reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(rgb_lo));
+    _mm_storel_epi64(
+      reinterpret_cast<__m128i *>(out + 16), _mm256_castsi256_si128(rgb_hi));
+    _mm_storeu_si128(
+      reinterpret_cast<__m128i *>(out + 24), _mm256_extracti128_si256(rgb_lo, 1));
+    _mm_storel_epi64(
+      reinterpret_cast<__m128i *>(out + 40), _mm256_extracti128_si256(rgb_hi, 1));
+  }
+
+  yuv422_to_rgb_sse41<Order>(src + 2 * i, dest + 3 * i, number_of_pixels - i);
+}
+
+#endif  // USB_CAM_SIMD_X86
+
+
+/// @brief Convert a packed 4:2:2 image (YUYV, UYVY, YVYU, ...) to RGB8 with the
+/// requested instruction set. All levels produce identical output; `level` should
+/// not exceed `get_simd_level()`.
+template<typename Order>
+inline void yuv422_to_rgb(
+  const unsigned char * src, unsigned char * dest, const int & number_of_pixels,
+  const simd_level_t & level = get_simd_level())
+{
+  switch (level) {
+#ifdef USB_CAM_SIMD_X86
+    case SIMD_LEVEL_AVX2:
+      return yuv422_to_rgb_avx2<Order>(src, dest, number_of_pixels);
+    case SIMD_LEVEL_SSE41:
+      return yuv422_to_rgb_sse41<Order>(src, dest, number_of_pixels);
+#endif
+    default:
+      return yuv422_to_rgb_scalar<Order>(src, dest, number_of_pixels);
+  }
+}
+
+}  // namespace formats
+}  // namespace usb_cam
+
+#endif  // USB_CAM__FORMATS__SIMD_HPP_
@@ -38,24 +38,14 @@ namespace formats
 {
 
 
-/** Clip a value to the range 0<val<255. For speed this is done using an
- * array, so can only cope with numbers in the range -128<=val<=383.
- */
-inline unsigned char CLIPVALUE(const int & val)
+/// @brief Clip a value to the range 0<=val<=255.
+///
+/// Plain integer saturation: compiles to branch free min/max (or cmov) code with
+/// no table lookup, so it can be inlined into the innermost conversion loops and
+/// auto-vectorized. Valid for any int, and usable in constant expressions.
+constexpr unsigned char CLIPVALUE(const int & val)
 {
-  // Old method (if)
-  /*   val = val < 0 ? 0 : val; */
-  /*   return val > 255 ? 255 : val; */
-
-  try {
-    // New method array
-    return usb_cam::constants::uchar_clipping_table.at(
-      val + usb_cam::constants::clipping_table_offset);
-  } catch (std::out_of_range const &) {
-    // fall back to old method
-    unsigned char clipped_val = val < 0 ? 0 : static_cast<unsigned char>(val);
-    return val > 255 ? 255 : clipped_val;
-  }
+  return static_cast<unsigned char>(val < 0 ? 0 : (val > 255 ? 255 : val));
 }
 
 /// @brief Conversion from YUV to RGB.
@@ -33,6 +33,7 @@
 #include "linux/videodev2.h"
 
 #include "usb_cam/formats/pixel_format_base.hpp"
+#include "usb_cam/formats/simd.hpp"
 #include "usb_cam/formats/utils.hpp"
 
 
@@ -64,10 +65,11 @@ public:
       "uyvy2rgb",
       V4L2_PIX_FMT_UYVY,
       usb_cam::constants::RGB8,
-      2,
+      3,
       8,
       true),
-    m_number_of_pixels(number_of_pixels)
+    m_number_of_pixels(number_of_pixels),
+    m_simd_level(get_simd_level())
   {}
 
   /// @brief In this format each four bytes is two pixels.
@@ -78,31 +80,29 @@ public:
   ///
   /// Source: https://www.linuxtv.org/downloads/v4l-dvb-apis-old/V4L2-PIX-FMT-YUYV.html
   ///
-  void convert(const char * & src, char * & dest, const int & bytes_used) override
+  /// Shares the vectorized kernels of YUYV2RGB, see `usb_cam/formats/simd.hpp`.
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
   {
     (void)bytes_used;    // not used by this conversion method
-    int i, j;
-    unsigned char y0, y1, u, v;
-    unsigned char r, g, b;
+    convert_band(src, dest, 0, m_number_of_pixels);
+    return true;
+  }
 
-    for (i = 0, j = 0; i < (static_cast<int>(m_number_of_pixels) << 1); i += 4, j += 6) {
-      u = (unsigned char)src[i + 0];
-      y0 = (unsigned char)src[i + 1];
-      v = (unsigned char)src[i + 2];
-      y1 = (unsigned char)src[i + 3];
-      YUV2RGB(y0, u, v, &r, &g, &b);
-      dest[j + 0] = r;
-      dest[j + 1] = g;
-      dest[j + 2] = b;
-      YUV2RGB(y1, u, v, &r, &g, &b);
-      dest[j + 3] = r;
-      dest[j + 4] = g;
-      dest[j + 5] = b;
-    }
+  bool is_band_splittable() override {return true;}
+
+  void convert_band(
+    const char * src, char * dest,
+    const size_t & first_pixel, const size_t & number_of_pixels) override
+  {
+    yuv422_to_rgb<uyvy_order>(
+      reinterpret_cast<const unsigned char *>(src) + 2 * first_pixel,
+      reinterpret_cast<unsigned char *>(dest) + 3 * first_pixel,
+      static_cast<int>(number_of_pixels), m_simd_level);
   }
 
 private:
-  size_t m_number_of_pixels;
+  int m_number_of_pixels;
+  simd_level_t m_simd_level;
 };
 
 }  // namespace formats
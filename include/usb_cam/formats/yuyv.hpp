@@ -33,6 +33,7 @@
 #include "linux/videodev2.h"
 
 #include "usb_cam/formats/pixel_format_base.hpp"
+#include "usb_cam/formats/simd.hpp"
 #include "usb_cam/formats/utils.hpp"
 
 
@@ -67,7 +68,8 @@ public:
       3,
       8,
       true),
-    m_number_of_pixels(number_of_pixels)
+    m_number_of_pixels(number_of_pixels),
+    m_simd_level(get_simd_level())
   {}
 
   /// @brief In this format each four bytes is two pixels.
@@ -78,33 +80,30 @@ public:
   ///
   /// Source: https://www.linuxtv.org/downloads/v4l-dvb-apis-old/V4L2-PIX-FMT-YUYV.html
   ///
-  void convert(const char * & src, char * & dest, const int & bytes_used) override
+  /// The conversion itself is done by the fastest kernel the CPU supports (see
+  /// `usb_cam/formats/simd.hpp`), all of which produce the same output.
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
   {
     (void)bytes_used;    // not used by this conversion method
-    int i, j;
-    unsigned char y0, y1, u, v;
-    unsigned char r, g, b;
+    convert_band(src, dest, 0, m_number_of_pixels);
+    return true;
+  }
+
+  bool is_band_splittable() override {return true;}
 
-    /// Total number of bytes should be 2 * number of pixels. Achieve this by bit-shifting
-    /// (NumPixels << 1). See format description above.
-    for (i = 0, j = 0; i < (m_number_of_pixels << 1); i += 4, j += 6) {
-      y0 = (unsigned char)src[i + 0];
-      u = (unsigned char)src[i + 1];
-      y1 = (unsigned char)src[i + 2];
-      v = (unsigned char)src[i + 3];
-      YUV2RGB(y0, u, v, &r, &g, &b);
-      dest[j + 0] = r;
-      dest[j + 1] = g;
-      dest[j + 2] = b;
-      YUV2RGB(y1, u, v, &r, &g, &b);
-      dest[j + 3] = r;
-      dest[j + 4] = g;
-      dest[j + 5] = b;
-    }
+  void convert_band(
+    const char * src, char * dest,
+    const size_t & first_pixel, const size_t & number_of_pixels) override
+  {
+    yuv422_to_rgb<yuyv_order>(
+      reinterpret_cast<const unsigned char *>(src) + 2 * first_pixel,
+      reinterpret_cast<unsigned char *>(dest) + 3 * first_pixel,
+      static_cast<int>(number_of_pixels), m_simd_level);
   }
 
 private:
   int m_number_of_pixels;
+  simd_level_t m_simd_level;
 };
 
 }  // namespace formats
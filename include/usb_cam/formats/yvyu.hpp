@@ -0,0 +1,92 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__FORMATS__YVYU_HPP_
+#define USB_CAM__FORMATS__YVYU_HPP_
+
+#include "linux/videodev2.h"
+
+#include "usb_cam/formats/pixel_format_base.hpp"
+#include "usb_cam/formats/simd.hpp"
+#include "usb_cam/formats/utils.hpp"
+
+
+namespace usb_cam
+{
+namespace formats
+{
+
+class YVYU2RGB : public pixel_format_base
+{
+public:
+  explicit YVYU2RGB(const int & number_of_pixels)
+  : pixel_format_base(
+      "yvyu2rgb",
+      V4L2_PIX_FMT_YVYU,
+      usb_cam::constants::RGB8,
+      3,
+      8,
+      true),
+    m_number_of_pixels(number_of_pixels),
+    m_simd_level(get_simd_level())
+  {}
+
+  /// @brief Same as YUYV with the Cb and Cr samples swapped.
+  ///
+  /// Source: https://www.kernel.org/doc/html/latest/userspace-api/media/v4l/pixfmt-packed-yuv.html
+  ///
+  /// Shares the vectorized kernels of YUYV2RGB, see `usb_cam/formats/simd.hpp`.
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
+  {
+    (void)bytes_used;    // not used by this conversion method
+    convert_band(src, dest, 0, m_number_of_pixels);
+    return true;
+  }
+
+  bool is_band_splittable() override {return true;}
+
+  void convert_band(
+    const char * src, char * dest,
+    const size_t & first_pixel, const size_t & number_of_pixels) override
+  {
+    yuv422_to_rgb<yvyu_order>(
+      reinterpret_cast<const unsigned char *>(src) + 2 * first_pixel,
+      reinterpret_cast<unsigned char *>(dest) + 3 * first_pixel,
+      static_cast<int>(number_of_pixels), m_simd_level);
+  }
+
+private:
+  int m_number_of_pixels;
+  simd_level_t m_simd_level;
+};
+
+}  // namespace formats
+}  // namespace usb_cam
+
+#endif  // USB_CAM__FORMATS__YVYU_HPP_
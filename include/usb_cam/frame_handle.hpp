@@ -0,0 +1,123 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef USB_CAM__FRAME_HANDLE_HPP_
+#define USB_CAM__FRAME_HANDLE_HPP_
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+
+namespace usb_cam
+{
+
+class UsbCam;
+
+/// @brief A captured frame read straight from the driver's buffer, without any copy.
+///
+/// The buffer is handed back to the camera when the handle is released or destroyed, see
+/// `UsbCam::release_frame`. While a handle is held the driver has one buffer less to capture
+/// into, so release handles promptly. The camera must outlive its handles.
+class FrameHandle
+{
+public:
+  /// @brief An empty handle, see `operator bool`
+  FrameHandle();
+  /// @param generation buffer generation of `camera` when the frame was dequeued
+  FrameHandle(
+    UsbCam * camera, const uint64_t & generation, const struct v4l2_buffer & buffer,
+    const char * data, const size_t & stride, const timespec & stamp);
+  ~FrameHandle();
+
+  FrameHandle(FrameHandle && other) noexcept;
+  FrameHandle & operator=(FrameHandle && other) noexcept;
+  FrameHandle(const FrameHandle &) = delete;
+  FrameHandle & operator=(const FrameHandle &) = delete;
+
+  /// @brief True if the handle holds a frame
+  explicit operator bool() const
+  {
+    return m_data != nullptr;
+  }
+
+  /// @brief Frame as captured, in the V4L2 pixel format of the device
+  inline const char * data() const
+  {
+    return m_data;
+  }
+
+  /// @brief Number of bytes of `data` holding the frame
+  inline size_t bytes_used() const
+  {
+    return m_buffer.bytesused;
+  }
+
+  /// @brief Number of bytes per line, 0 for compressed formats
+  inline size_t stride() const
+  {
+    return m_stride;
+  }
+
+  /// @brief Index of the driver buffer holding the frame, e.g. to pick the matching
+  /// fd from `UsbCam::export_dmabufs`
+  inline uint32_t index() const
+  {
+    return m_buffer.index;
+  }
+
+  /// @brief V4L2 sequence number of the frame
+  inline uint32_t sequence() const
+  {
+    return m_buffer.sequence;
+  }
+
+  inline timespec timestamp() const
+  {
+    return m_stamp;
+  }
+
+  /// @brief Hand the buffer back to the driver, leaving the handle empty
+  void release();
+
+private:
+  UsbCam * m_camera;
+  uint64_t m_generation;
+  struct v4l2_buffer m_buffer;
+  const char * m_data;
+  size_t m_stride;
+  timespec m_stamp;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__FRAME_HANDLE_HPP_
@@ -0,0 +1,135 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef USB_CAM__SPSC_RING_HPP_
+#define USB_CAM__SPSC_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+
+namespace usb_cam
+{
+
+/// @brief Bounded lock-free ring between a single producer and a single consumer thread.
+///
+/// Meant for small trivially copyable values such as indices into a pool of frames, every
+/// element is stored in an atomic so that besides `try_pop` on the consumer side the
+/// producer can `drop_oldest` when the consumer falls behind, without either side ever
+/// waiting on a lock.
+template<typename T>
+class SpscRing
+{
+  static_assert(
+    std::is_trivially_copyable<T>::value, "SpscRing elements must be trivially copyable");
+
+public:
+  explicit SpscRing(const size_t & capacity)
+  : m_capacity(capacity),
+    m_slots(new std::atomic<T>[capacity]),
+    m_head(0),
+    m_tail(0)
+  {}
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing & operator=(const SpscRing &) = delete;
+
+  /// @brief Producer only. Append `value`
+  /// @return false if the ring is full
+  bool try_push(const T & value)
+  {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) >= m_capacity) {
+      return false;
+    }
+    m_slots[head % m_capacity].store(value, std::memory_order_relaxed);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Consumer only. Take the oldest element
+  /// @return false if the ring is empty
+  bool try_pop(T & value)
+  {
+    return take_oldest(value);
+  }
+
+  /// @brief Producer only. Take the oldest element away from the consumer, e.g. to reuse
+  /// the frame it refers to when the consumer can't keep up
+  /// @return false if the ring is empty
+  bool drop_oldest(T & value)
+  {
+    return take_oldest(value);
+  }
+
+  /// @brief Number of elements in the ring, only a snapshot while the other side is active
+  size_t size() const
+  {
+    return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+  }
+
+  inline bool empty() const
+  {
+    return size() == 0;
+  }
+
+  inline size_t capacity() const
+  {
+    return m_capacity;
+  }
+
+private:
+  /// @brief Both sides may take the oldest element, whoever advances `m_tail` first owns
+  /// it. The producer only overwrites a slot once `m_tail` moved past it, so a slot read
+  /// before a successful exchange still held the element that was taken.
+  bool take_oldest(T & value)
+  {
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    do {
+      if (m_head.load(std::memory_order_acquire) == tail) {
+        return false;
+      }
+      value = m_slots[tail % m_capacity].load(std::memory_order_relaxed);
+    } while (!m_tail.compare_exchange_weak(
+      tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+    return true;
+  }
+
+  const size_t m_capacity;
+  std::unique_ptr<std::atomic<T>[]> m_slots;
+  /// @brief Number of elements ever pushed, only written by the producer
+  std::atomic<size_t> m_head;
+  /// @brief Number of elements ever taken, by either side
+  std::atomic<size_t> m_tail;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__SPSC_RING_HPP_
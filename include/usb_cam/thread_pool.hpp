@@ -0,0 +1,91 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__THREAD_POOL_HPP_
+#define USB_CAM__THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace usb_cam
+{
+
+/// @brief Fixed size pool of worker threads used to split the work on a single frame.
+/// Threads are created once and reused for every frame, the calling thread takes part
+/// in the work as well.
+class ThreadPool
+{
+public:
+  /// @brief Create a pool that runs tasks on `number_of_threads` threads in total
+  /// (`number_of_threads - 1` workers plus the thread calling `run`)
+  explicit ThreadPool(const size_t & number_of_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  /// @brief Call `task(i)` for every i in [0, number_of_tasks) across the pool and
+  /// block until all of them have finished. The first exception thrown by a task
+  /// is rethrown here.
+  void run(const size_t & number_of_tasks, const std::function<void(size_t)> & task);
+
+  /// @brief Number of threads work is spread across, including the caller of `run`
+  inline size_t size()
+  {
+    return m_workers.size() + 1;
+  }
+
+private:
+  void worker();
+  void run_tasks();
+
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_work_cv;
+  std::condition_variable m_done_cv;
+
+  const std::function<void(size_t)> * m_task;
+  size_t m_number_of_tasks;
+  std::atomic<size_t> m_next_task;
+  std::exception_ptr m_exception;
+  uint64_t m_generation;
+  size_t m_busy_workers;
+  bool m_stop;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__THREAD_POOL_HPP_
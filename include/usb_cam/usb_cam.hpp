@@ -35,14 +35,27 @@ extern "C" {
 #include <linux/videodev2.h>
 }
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "usb_cam/buffer_depth_policy.hpp"
+#include "usb_cam/capability_cache.hpp"
+#include "usb_cam/capture_stats.hpp"
+#include "usb_cam/decoder_pipeline.hpp"
+#include "usb_cam/device_watcher.hpp"
+#include "usb_cam/format_negotiation.hpp"
+#include "usb_cam/frame_handle.hpp"
+#include "usb_cam/thread_pool.hpp"
 #include "usb_cam/utils.hpp"
+#include "usb_cam/v4l2_controls.hpp"
 #include "usb_cam/formats/pixel_format_base.hpp"
 
 #include "usb_cam/formats/mjpeg.hpp"
@@ -50,6 +63,7 @@ extern "C" {
 #include "usb_cam/formats/rgb.hpp"
 #include "usb_cam/formats/uyvy.hpp"
 #include "usb_cam/formats/yuyv.hpp"
+#include "usb_cam/formats/yvyu.hpp"
 #include "usb_cam/formats/m420.hpp"
 
 
@@ -60,12 +74,6 @@ using usb_cam::utils::io_method_t;
 using usb_cam::formats::pixel_format_base;
 
 
-typedef struct
-{
-  struct v4l2_fmtdesc format;
-  struct v4l2_frmivalenum v4l2_fmt;
-} capture_format_t;
-
 typedef struct
 {
   std::string camera_name;  // can be anything
@@ -93,6 +101,25 @@ typedef struct
   bool auto_white_balance;
   bool autoexposure;
   bool autofocus;
+  // number of threads used to convert each frame, 1 converts on the capture thread only
+  int conversion_threads;
+  // number of MJPEG frames decoded in parallel, adds (decoder_threads - 1) frames of latency
+  int decoder_threads;
+  // 1, 2, 4 or 8, decode MJPEG at that fraction of the captured width and height
+  int decode_scale;
+  // number of captured frames buffered for publishing, the oldest is dropped when full
+  int frame_queue_size;
+  // number of frame periods without a frame before the device is considered stalled, at
+  // least 2 seconds
+  int stall_timeout_frames;
+  // only convert the newest ready frame, requeueing older ones unconverted
+  bool latest_frame_only;
+  // number of buffers requested from the driver, fewer buffers mean less latency
+  int buffer_count;
+  // grow or shrink the buffers cycled through the driver from dropped frames and dequeue lag
+  bool adaptive_buffer_count;
+  // keep the supported formats and controls on disk, see `CapabilityCache`
+  bool cache_capabilities;
 } parameters_t;
 
 typedef struct
@@ -104,8 +131,10 @@ typedef struct
   size_t number_of_pixels;
   size_t bytes_per_line;
   size_t size_in_bytes;
+  size_t bytes_used;  // bytes of `data` holding the latest image, see `is_compressed`
   v4l2_format v4l2_fmt;
   struct timespec stamp;
+  uint32_t sequence;
 
   size_t set_number_of_pixels()
   {
@@ -140,6 +169,12 @@ public:
   /// Requires that `set_parameters` was already called
   void configure();
 
+  /// @brief Apply new parameters to a configured device without closing it
+  /// Streaming stops, the buffers are freed and the format, framerate and buffers are set up
+  /// again; streaming resumes if it was on. Controls are not touched, see `set_v4l2_params`.
+  /// Throws if `device_name` or `io_method` changed, those need `shutdown` and `configure`
+  void reconfigure(const parameters_t & parameters);
+
   /// @brief Start the configured device
   void start();
 
@@ -156,8 +191,62 @@ public:
 
   /// @brief Overload of get_image to allow users to pass
   /// in an image pointer to fill in
-  void get_image(char * destination);
+  /// @return false if no image was taken, e.g. because of `interrupt`
+  ///
+  /// Like `get_image()`, copies or converts the frame into the image once, also with the
+  /// userptr IO method: its buffer goes back to the driver before returning. `get_frame`
+  /// avoids the copy.
+  ///
+  /// When the device is lost, i.e. unplugged or reset on the USB bus, `get_image` and
+  /// `get_frame` return without an image instead of throwing, and from then on each call
+  /// waits up to a quarter of a second for the device to come back. Once it is back it is
+  /// opened and configured as before, its controls are set again and capturing resumes.
+  /// `get_stats` reports the outage.
+  bool get_image(char * destination);
+
+  /// @brief Take a new frame without copying or converting it, straight from the driver's
+  /// buffer. Requires the mmap or userptr IO method. See `FrameHandle` for how long the
+  /// buffer can be held. A frame of the mmap IO method must not be read anymore once
+  /// `get_frame` is called after losing the device, the buffer is unmapped then. A frame in
+  /// a buffer passed to `set_user_buffers` stays valid, its buffer is only handed to the
+  /// reopened device once the frame is released.
+  /// @return an empty handle if interrupted, see `interrupt`
+  FrameHandle get_frame();
+
+  /// @brief Hand the buffer of a frame taken with `get_frame` back to the driver, called by
+  /// `FrameHandle::release`. Safe to call from any thread: the buffer is queued by the
+  /// capturing thread on its next wait for a frame, unless the buffers were freed or
+  /// replaced since the frame was taken.
+  /// @param generation buffer generation the frame was taken from
+  void release_frame(uint32_t index, uint64_t generation);
+
+  /// @brief Capture straight into caller owned memory with the userptr IO method, e.g. the
+  /// data of the messages to publish, so that no copy is needed when combined with
+  /// `get_frame`. Call after `configure` and before capturing starts. The buffers must
+  /// hold at least `get_capture_buffer_size()` bytes each, and stay valid and untouched
+  /// while queued to the driver, i.e. until `shutdown` or until their frame is taken with
+  /// `get_frame`. The driver may use fewer buffers than given, see `number_of_buffers`.
+  void set_user_buffers(const std::vector<usb_cam::utils::buffer> & buffers);
+
+  /// @brief Minimum size in bytes of a buffer the driver captures into
+  inline size_t get_capture_buffer_size()
+  {
+    return std::max<size_t>(m_image.size_in_bytes, m_image.v4l2_fmt.fmt.pix.sizeimage);
+  }
+
+  /// @brief Export every capture buffer as a DMABUF, so that other processes or devices
+  /// (encoders, GPUs, ...) can import frames without copying them. Requires the mmap IO
+  /// method. The fds stay owned by this object and are closed by `shutdown`, `dup` them
+  /// to keep them longer. Use `FrameHandle::index` to find the buffer holding a frame.
+  /// @return one read only DMABUF fd per buffer, indexed by buffer index
+  std::vector<int> export_dmabufs();
 
+  /// @brief Make a `get_image` or `get_frame` call waiting for a frame, or else the next
+  /// one, return without an image. Safe to call from any thread.
+  void interrupt();
+
+  /// @brief Enumerate every format, frame size and frame interval of the device, and store
+  /// them in the capability cache. Prefer `supported_formats`, which reuses earlier results.
   std::vector<capture_format_t> get_supported_formats();
 
   // enables/disable auto focus
@@ -167,6 +256,24 @@ public:
   bool set_v4l_parameter(const std::string & param, int value);
   bool set_v4l_parameter(const std::string & param, const std::string & value);
 
+  /// @brief Set several controls by name with a single `VIDIOC_S_EXT_CTRLS`, see
+  /// `V4l2Controls::set`. Names are those `v4l2-ctl --list-ctrls` prints. Like the other
+  /// control functions, safe to call from any thread while capturing.
+  /// @return false if any of the controls could not be set
+  bool set_v4l_parameters(const std::vector<V4l2Controls::value_t> & values);
+
+  /// @brief Read the current value of a control by name
+  /// @return false if the device has no such control or it can't be read
+  bool get_v4l_parameter(const std::string & param, int64_t & value);
+
+  /// @brief Controls of the open device, enumerated when it was opened. A copy, as they
+  /// are enumerated again when the device is reopened after being lost
+  inline V4l2Controls get_controls()
+  {
+    std::lock_guard<std::mutex> lock(m_controls_mutex);
+    return m_controls;
+  }
+
   parameters_t parameters()
   {
     return m_parameters;
@@ -185,11 +292,25 @@ public:
     return m_image.height;
   }
 
+  /// @brief Get factor the published image is downscaled by relative to the captured
+  /// image, in each dimension. 1 unless the pixel format decodes at a reduced scale.
+  inline int get_image_scale()
+  {
+    return m_image.pixel_format->decode_scale();
+  }
+
   inline size_t get_image_size()
   {
     return m_image.size_in_bytes;
   }
 
+  /// @brief Get number of bytes of the latest image. Equal to `get_image_size` unless the
+  /// pixel format is compressed, in which case it varies from frame to frame
+  inline size_t get_image_bytes_used()
+  {
+    return m_image.bytes_used;
+  }
+
   inline timespec get_image_timestamp()
   {
     return m_image.stamp;
@@ -232,6 +353,25 @@ public:
     return m_number_of_buffers;
   }
 
+  /// @brief Frame drops, errors and lags, readable from any thread while capturing
+  inline CaptureStats & get_stats()
+  {
+    return m_stats;
+  }
+
+  /// @brief Number of buffers cycled through the driver, at most `number_of_buffers`.
+  /// Changes over time with `adaptive_buffer_count`
+  inline unsigned int get_buffer_depth()
+  {
+    return m_buffer_depth;
+  }
+
+  /// @brief Cycle `depth` buffers through the driver. Buffers are created with
+  /// `VIDIOC_CREATE_BUFS` when there are too few, and held back from the driver when there
+  /// are too many. Only buffers requeued by `UsbCam` itself are held back, not those
+  /// released from a `FrameHandle`.
+  void set_buffer_depth(unsigned int depth);
+
   inline AVCodec * get_avcodec()
   {
     return m_avcodec;
@@ -262,130 +402,95 @@ public:
     return m_epoch_time_shift;
   }
 
+  /// @brief Supported formats, only enumerated from the device (see
+  /// `get_supported_formats`) if they are neither known yet nor in the capability cache
   inline std::vector<capture_format_t> supported_formats()
   {
-    if (m_supported_formats.size() == 0) {
+    if (m_supported_formats.size() == 0 &&
+      !(m_capability_cache && m_capability_cache->load_formats(m_supported_formats)))
+    {
       this->get_supported_formats();
     }
 
     return m_supported_formats;
   }
 
-  /// @brief Get pixel format from string. Required to have logic within UsbCam object
-  /// in case pixel format class requires additional information for conversion function
-  /// (e.g. number of pixels, width, height, etc.)
+  /// @brief Create a new pixel format object from string. Required to have logic within
+  /// UsbCam object in case pixel format class requires additional information for conversion
+  /// function (e.g. number of pixels, width, height, etc.)
   /// @param str name of supported format (see `usb_cam/supported_formats.hpp`)
-  /// @return pixel format structure corresponding to a given name
-  inline std::shared_ptr<pixel_format_base> set_pixel_format_from_string(const std::string & str)
+  /// @return new pixel format structure corresponding to a given name
+  inline std::shared_ptr<pixel_format_base> create_pixel_format(const std::string & str)
   {
     using usb_cam::formats::RGB8;
     using usb_cam::formats::YUYV;
     using usb_cam::formats::YUYV2RGB;
     using usb_cam::formats::UYVY;
     using usb_cam::formats::UYVY2RGB;
+    using usb_cam::formats::YVYU2RGB;
     using usb_cam::formats::MONO8;
     using usb_cam::formats::MONO16;
     using usb_cam::formats::Y102MONO8;
+    using usb_cam::formats::MJPEG;
     using usb_cam::formats::MJPEG2RGB;
+    using usb_cam::formats::MJPEG2MONO8;
     using usb_cam::formats::M4202RGB;
 
     if (str == "rgb8") {
-      m_image.pixel_format = std::make_shared<RGB8>();
+      return std::make_shared<RGB8>();
     } else if (str == "yuyv") {
-      m_image.pixel_format = std::make_shared<YUYV>();
+      return std::make_shared<YUYV>();
     } else if (str == "yuyv2rgb") {
       // number of pixels required for conversion method
-      m_image.pixel_format = std::make_shared<YUYV2RGB>(m_image.number_of_pixels);
+      return std::make_shared<YUYV2RGB>(m_image.number_of_pixels);
     } else if (str == "uyvy") {
-      m_image.pixel_format = std::make_shared<UYVY>();
+      return std::make_shared<UYVY>();
     } else if (str == "uyvy2rgb") {
       // number of pixels required for conversion method
-      m_image.pixel_format = std::make_shared<UYVY2RGB>(m_image.number_of_pixels);
+      return std::make_shared<UYVY2RGB>(m_image.number_of_pixels);
+    } else if (str == "yvyu2rgb") {
+      // number of pixels required for conversion method
+      return std::make_shared<YVYU2RGB>(m_image.number_of_pixels);
+    } else if (str == "mjpeg") {
+      return std::make_shared<MJPEG>();
     } else if (str == "mjpeg2rgb") {
-      m_image.pixel_format = std::make_shared<MJPEG2RGB>(
-        m_image.width, m_image.height);
+      return std::make_shared<MJPEG2RGB>(
+        m_parameters.image_width, m_parameters.image_height, m_parameters.decode_scale);
+    } else if (str == "mjpeg2mono8") {
+      return std::make_shared<MJPEG2MONO8>(
+        m_parameters.image_width, m_parameters.image_height, m_parameters.decode_scale);
     } else if (str == "m4202rgb") {
-      m_image.pixel_format = std::make_shared<M4202RGB>(
+      return std::make_shared<M4202RGB>(
         m_image.width, m_image.height);
     } else if (str == "mono8") {
-      m_image.pixel_format = std::make_shared<MONO8>();
+      return std::make_shared<MONO8>();
     } else if (str == "mono16") {
-      m_image.pixel_format = std::make_shared<MONO16>();
+      return std::make_shared<MONO16>();
     } else if (str == "y102mono8") {
-      m_image.pixel_format = std::make_shared<Y102MONO8>(m_image.number_of_pixels);
+      return std::make_shared<Y102MONO8>(m_image.number_of_pixels);
     } else {
       throw std::invalid_argument("Unsupported pixel format specified: " + str);
     }
+  }
 
+  /// @brief Get pixel format from string and make it the current pixel format
+  /// @param str name of supported format (see `usb_cam/supported_formats.hpp`)
+  /// @return pixel format structure corresponding to a given name
+  inline std::shared_ptr<pixel_format_base> set_pixel_format_from_string(const std::string & str)
+  {
+    m_image.pixel_format = create_pixel_format(str);
     return m_image.pixel_format;
   }
 
-  /// @brief Send current parameters to V4L2 device
-  /// TODO(flynneva): only send parameters that changed
+  /// @brief Send the controls of `parameters` (brightness, exposure, ...) that changed since
+  /// they were last sent, all in one batch. Doesn't touch the parameters used for capturing,
+  /// so it can be called from any thread while capturing.
+  void set_v4l2_params(const parameters_t & parameters);
+
+  /// @brief Send the controls of the current parameters that changed since they were last sent
   inline void set_v4l2_params()
   {
-    // set camera parameters
-    if (m_parameters.brightness >= 0) {
-      std::cout << "Setting 'brightness' to " << m_parameters.brightness << std::endl;
-      this->set_v4l_parameter("brightness", m_parameters.brightness);
-    }
-
-    if (m_parameters.contrast >= 0) {
-      std::cout << "Setting 'contrast' to " << m_parameters.contrast << std::endl;
-      this->set_v4l_parameter("contrast", m_parameters.contrast);
-    }
-
-    if (m_parameters.saturation >= 0) {
-      std::cout << "Setting 'saturation' to " << m_parameters.saturation << std::endl;
-      this->set_v4l_parameter("saturation", m_parameters.saturation);
-    }
-
-    if (m_parameters.sharpness >= 0) {
-      std::cout << "Setting 'sharpness' to " << m_parameters.sharpness;
-      this->set_v4l_parameter("sharpness", m_parameters.sharpness);
-    }
-
-    if (m_parameters.gain >= 0) {
-      std::cout << "Setting 'gain' to " << m_parameters.gain << std::endl;
-      this->set_v4l_parameter("gain", m_parameters.gain);
-    }
-
-    // check auto white balance
-    if (m_parameters.auto_white_balance) {
-      this->set_v4l_parameter("white_balance_temperature_auto", 1);
-      std::cout << "Setting 'white_balance_temperature_auto' to " << 1 << std::endl;
-    } else {
-      std::cout << "Setting 'white_balance' to " << m_parameters.white_balance << std::endl;
-      this->set_v4l_parameter("white_balance_temperature_auto", 0);
-      this->set_v4l_parameter("white_balance_temperature", m_parameters.white_balance);
-    }
-
-    // check auto exposure
-    if (!m_parameters.autoexposure) {
-      std::cout << "Setting 'exposure_auto' to " << 1 << std::endl;
-      std::cout << "Setting 'exposure' to " << m_parameters.exposure << std::endl;
-      // turn down exposure control (from max of 3)
-      this->set_v4l_parameter("exposure_auto", 1);
-      // change the exposure level
-      this->set_v4l_parameter("exposure_absolute", m_parameters.exposure);
-    } else {
-      std::cout << "Setting 'exposure_auto' to " << 3 << std::endl;
-      this->set_v4l_parameter("exposure_auto", 3);
-    }
-
-    // check auto focus
-    if (m_parameters.autofocus) {
-      this->set_auto_focus(1);
-      std::cout << "Setting 'focus_auto' to " << 1 << std::endl;
-      this->set_v4l_parameter("focus_auto", 1);
-    } else {
-      std::cout << "Setting 'focus_auto' to " << 0 << std::endl;
-      this->set_v4l_parameter("focus_auto", 0);
-      if (m_parameters.focus >= 0) {
-        std::cout << "Setting 'focus_absolute' to " << m_parameters.focus << std::endl;
-        this->set_v4l_parameter("focus_absolute", m_parameters.focus);
-      }
-    }
+    set_v4l2_params(m_parameters);
   }
 
   inline void assign_parameters(parameters_t & new_parameters)
@@ -397,20 +502,71 @@ private:
   void init_read();
   void init_mmap();
   void init_userp();
+  void init_buffer(uint32_t index);
+  unsigned int create_buffers(unsigned int count);
+  void queue_buffer(uint32_t index);
+  void requeue_released_buffers();
+  void register_user_buffers(const std::vector<usb_cam::utils::buffer> & buffers);
   void init_device();
+  void configure_format();
 
   void open_device();
-  void grab_image();
-  void read_frame();
-  void process_image(const char * src, char * & dest, const int & bytes_used);
+  bool grab_image();
+  bool wait_for_frame();
+  bool is_device_gone();
+  bool set_controls(const std::vector<V4l2Controls::value_t> & values);
+  void lose_device();
+  void release_device();
+  bool reconnect();
+  timespec get_buffer_stamp(const struct v4l2_buffer & buf);
+  int64_t get_buffer_lag_us(const struct v4l2_buffer & buf);
+  void handle_events();
+  bool read_frame();
+  bool dequeue_buffer(struct v4l2_buffer & buf);
+  void dequeue_latest_buffer(struct v4l2_buffer & buf);
+  bool process_image(const char * src, char * & dest, const int & bytes_used);
 
   void uninit_device();
   void close_device();
 
   usb_cam::utils::io_method_t m_io;
   int m_fd;
+  int m_epoll_fd;
+  /// @brief eventfd written by `interrupt` to wake up `grab_image`
+  int m_wakeup_fd;
+  /// @brief eventfd written by `release_frame` to wake up `wait_for_frame`. Guarded by
+  /// `m_released_mutex`
+  int m_release_fd;
+  /// @brief Frame period reported by the driver
+  int64_t m_frame_period_us;
   usb_cam::utils::buffer * m_buffers;
   unsigned int m_number_of_buffers;
+  /// @brief True if `m_buffers` were passed to `set_user_buffers` and belong to the caller
+  bool m_user_buffers;
+  /// @brief Counts up whenever the buffers are freed or replaced, so that frames taken
+  /// before are not handed back to the driver, see `release_frame`
+  uint64_t m_buffer_generation;
+  /// @brief Buffer index and generation of the frames released since the last
+  /// `requeue_released_buffers`. Guarded by `m_released_mutex`
+  std::vector<std::pair<uint32_t, uint64_t>> m_released_buffers;
+  std::mutex m_released_mutex;
+  /// @brief Buffers of frames taken with `get_frame` and not released yet, which capturing
+  /// must not hand to the driver when it starts
+  std::vector<uint32_t> m_held_buffers;
+  /// @brief Number of buffers cycled through the driver, see `set_buffer_depth`. Atomic so
+  /// that `get_buffer_depth` can be read from any thread while capturing
+  std::atomic<unsigned int> m_buffer_depth;
+  /// @brief Buffers held back from the driver while there are more than `m_buffer_depth`
+  std::vector<uint32_t> m_parked_buffers;
+  /// @brief Only created with `adaptive_buffer_count`
+  std::unique_ptr<BufferDepthPolicy> m_buffer_depth_policy;
+  CaptureStats m_stats;
+  V4l2Controls m_controls;
+  /// @brief Last value sent for each control, cleared when the device is opened
+  std::map<std::string, int64_t> m_applied_controls;
+  /// @brief Guards `m_controls`, `m_applied_controls` and replacing `m_fd`, so controls can
+  /// be set while capturing and while reconnecting
+  std::mutex m_controls_mutex;
   image_t m_image;
   parameters_t m_parameters;
 
@@ -421,10 +577,27 @@ private:
   AVDictionary * m_avoptions;
   AVCodecContext * m_avcodec_context;
 
-  int64_t m_buffer_time_s;
+  /// @brief Only created when `conversion_threads` > 1 and the pixel format can be
+  /// converted in bands, see `pixel_format_base::is_band_splittable`
+  std::unique_ptr<ThreadPool> m_conversion_pool;
+  /// @brief Only created when `decoder_threads` > 1 and capturing MJPEG via mmap or userptr
+  std::unique_ptr<DecoderPipeline> m_decoder_pipeline;
+
+  /// @brief True while capturing, also while the device is lost and capturing resumes once
+  /// it is back
   bool m_is_capturing;
+  /// @brief Set where an ioctl fails with `ENODEV`, the device is released by the next
+  /// `wait_for_frame`
+  bool m_device_lost;
+  /// @brief Only created while the device is lost, see `reconnect`
+  std::unique_ptr<DeviceWatcher> m_device_watcher;
+  std::chrono::steady_clock::time_point m_lost_at;
+  /// @brief Buffers passed to `set_user_buffers` before the device was lost
+  std::vector<usb_cam::utils::buffer> m_lost_user_buffers;
   const time_t m_epoch_time_shift;
   std::vector<capture_format_t> m_supported_formats;
+  /// @brief Only created with `cache_capabilities`, for the device that is open
+  std::unique_ptr<CapabilityCache> m_capability_cache;
 };
 
 }  // namespace usb_cam
@@ -31,10 +31,17 @@
 #ifndef USB_CAM__USB_CAM_NODE_HPP_
 #define USB_CAM__USB_CAM_NODE_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "diagnostic_msgs/msg/diagnostic_array.hpp"
+#include "sensor_msgs/msg/compressed_image.hpp"
 #include "sensor_msgs/msg/image.hpp"
 #include "sensor_msgs/msg/camera_info.hpp"
 #include "std_srvs/srv/set_bool.hpp"
@@ -46,6 +53,7 @@
 #include "image_transport/image_transport.hpp"
 #include "rclcpp/rclcpp.hpp"
 
+#include "usb_cam/spsc_ring.hpp"
 #include "usb_cam/usb_cam.hpp"
 
 
@@ -59,6 +67,38 @@ std::ostream & operator<<(std::ostream & ostr, const rclcpp::Time & tm)
 namespace usb_cam
 {
 
+/// @brief Layout of a captured image. Copied from the camera by the capture thread, since
+/// the camera's own description is set up again while reconnecting to a lost device
+typedef struct
+{
+  bool compressed;
+  std::string encoding;
+  uint32_t width;
+  uint32_t height;
+  uint32_t step;
+  /// @brief See `UsbCam::get_image_scale`
+  int scale;
+} frame_format_t;
+
+/// @brief A captured image on its way from the capture thread to the publishing thread
+typedef struct
+{
+  sensor_msgs::msg::Image::_data_type data;
+  size_t bytes_used;
+  timespec stamp;
+  /// @brief The publishing thread only looks at this, never at the camera
+  frame_format_t format;
+  /// @brief When the capture thread was done with the frame, to measure the publish lag
+  std::chrono::steady_clock::time_point dequeued;
+  /// @brief Only used when capturing straight into `data`, holds the buffer away from the
+  /// driver until the frame is published
+  FrameHandle handle;
+} frame_t;
+
+/// @brief Captures on one thread and publishes on another, so that slow subscribers never
+/// delay dequeuing the next frame from the driver. Captured frames are handed over through
+/// a bounded lock-free ring; when publishing falls behind the oldest waiting frame is
+/// dropped in favour of the newest.
 class UsbCamNode : public rclcpp::Node
 {
 public:
@@ -66,11 +106,22 @@ public:
   ~UsbCamNode();
 
   void init();
+  void init_publishers();
+  void init_frames();
+  void start_threads();
+  bool reconfigure(const parameters_t & previous_parameters, std::string & error);
   void get_ros_params();
   void assign_ros_params(
     const std::vector<rclcpp::Parameter> & parameters);
-  void update();
-  bool take_and_send_image();
+  void capture_loop();
+  void capture_loop_zero_copy();
+  void apply_pending_parameters();
+  void get_frame_format(frame_format_t & format);
+  void publish_loop();
+  void stop_threads();
+  void publish_stats();
+  void publish_image(frame_t & frame);
+  void publish_image_mjpeg(frame_t & frame);
 
   rcl_interfaces::msg::SetParametersResult parameters_callback(
     const std::vector<rclcpp::Parameter> & parameters);
@@ -85,12 +136,43 @@ public:
   sensor_msgs::msg::Image::UniquePtr m_image_msg;
   std::shared_ptr<image_transport::CameraPublisher> m_image_publisher;
 
+  /// @brief Only used for compressed pixel formats, e.g. `mjpeg`
+  sensor_msgs::msg::CompressedImage::UniquePtr m_compressed_img_msg;
+  rclcpp::Publisher<sensor_msgs::msg::CompressedImage>::SharedPtr m_compressed_image_publisher;
+  rclcpp::Publisher<sensor_msgs::msg::CameraInfo>::SharedPtr m_compressed_cam_info_publisher;
+
   sensor_msgs::msg::CameraInfo::UniquePtr m_camera_info_msg;
   std::shared_ptr<camera_info_manager::CameraInfoManager> m_camera_info;
 
   std::vector<rclcpp::Parameter> m_ros_parameters;
-
-  rclcpp::TimerBase::SharedPtr m_timer;
+  /// @brief Parameters as last set, only used by the executor. The camera's own copy is
+  /// updated by the capture thread, see `apply_pending_parameters`
+  parameters_t m_parameters{};
+  std::mutex m_pending_parameters_mutex;
+  std::unique_ptr<parameters_t> m_pending_parameters;
+
+  /// @brief Serializes access to `m_camera` between the capture thread, services and
+  /// parameter callbacks
+  std::mutex m_camera_mutex;
+  std::thread m_capture_thread;
+  std::thread m_publish_thread;
+  std::atomic<bool> m_running{false};
+
+  /// @brief Pool of frames, `m_free_frames` and `m_captured_frames` hold indices into it
+  std::vector<frame_t> m_frames;
+  std::unique_ptr<SpscRing<uint32_t>> m_free_frames;
+  std::unique_ptr<SpscRing<uint32_t>> m_captured_frames;
+  /// @brief Only used to put the publishing thread to sleep while there is nothing to publish
+  std::mutex m_captured_mutex;
+  std::condition_variable m_captured_cv;
+  /// @brief True if the driver captures straight into the frames' data, see
+  /// `UsbCam::set_user_buffers`
+  bool m_zero_copy{false};
+
+  /// @brief Publishes the counters of `UsbCam::get_stats` once per second
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr m_diagnostics_publisher;
+  rclcpp::TimerBase::SharedPtr m_stats_timer;
+  capture_stats_t m_last_stats{};
 
   rclcpp::Service<std_srvs::srv::SetBool>::SharedPtr m_service_capture;
   rclcpp::node_interfaces::OnSetParametersCallbackHandle::SharedPtr m_parameters_callback_handle;
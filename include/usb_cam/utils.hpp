@@ -62,6 +62,7 @@ struct buffer
 {
   char * start;
   size_t length;
+  int dmabuf_fd;  // -1 unless exported, see `UsbCam::export_dmabufs`
 };
 
 
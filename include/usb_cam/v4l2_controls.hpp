@@ -0,0 +1,98 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef USB_CAM__V4L2_CONTROLS_HPP_
+#define USB_CAM__V4L2_CONTROLS_HPP_
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace usb_cam
+{
+
+/// @brief Controls of a V4L2 device, set and read by name with `VIDIOC_S_EXT_CTRLS` and
+/// `VIDIOC_G_EXT_CTRLS`.
+///
+/// The controls are enumerated once with `VIDIOC_QUERY_EXT_CTRL` and named the way
+/// `v4l2-ctl` names them, e.g. "White Balance, Automatic" is `white_balance_automatic`.
+/// Names used by older kernels, such as `white_balance_temperature_auto`, resolve to the
+/// same control.
+class V4l2Controls
+{
+public:
+  typedef std::pair<std::string, int64_t> value_t;
+
+  /// @brief Enumerate the controls of the device behind `fd`, replacing earlier ones
+  void enumerate(int fd);
+  /// @brief Use controls enumerated earlier, e.g. from a `CapabilityCache`
+  void assign(const std::vector<struct v4l2_query_ext_ctrl> & controls);
+  /// @return the controls as enumerated, e.g. to store them in a `CapabilityCache`
+  std::vector<struct v4l2_query_ext_ctrl> list() const;
+  void clear();
+
+  /// @return the control named `name`, or nullptr if the device has no such control
+  const struct v4l2_query_ext_ctrl * find(const std::string & name) const;
+
+  /// @brief Set all `values` with a single `VIDIOC_S_EXT_CTRLS`. If the driver rejects the
+  /// batch, every control is set on its own, in order, so that one bad value doesn't keep
+  /// the others from being set.
+  /// @return the names of the controls that could not be set
+  std::vector<std::string> set(int fd, const std::vector<value_t> & values) const;
+
+  /// @brief Read the current value of the control named `name`
+  /// @return false if the device has no such control or it can't be read
+  bool get(int fd, const std::string & name, int64_t & value) const;
+
+  /// @brief Name of a control the way `v4l2-ctl` prints it: lower case alphanumeric words
+  /// joined by underscores
+  static std::string normalize_name(const char * name);
+
+  inline const std::map<std::string, struct v4l2_query_ext_ctrl> & controls() const
+  {
+    return m_controls;
+  }
+
+private:
+  bool set_one(int fd, const struct v4l2_query_ext_ctrl & control, int64_t value) const;
+
+  std::map<std::string, struct v4l2_query_ext_ctrl> m_controls;
+  std::map<uint32_t, std::string> m_names;
+};
+
+}  // namespace usb_cam
+
+#endif  // USB_CAM__V4L2_CONTROLS_HPP_
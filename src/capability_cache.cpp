@@ -0,0 +1,212 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "usb_cam/capability_cache.hpp"
+
+
+namespace usb_cam
+{
+
+namespace
+{
+
+/// @brief Bump when the layout of the entries changes
+const uint32_t CACHE_VERSION = 1;
+
+std::string to_string(const __u8 * text, size_t size)
+{
+  const char * begin = reinterpret_cast<const char *>(text);
+  size_t length = 0;
+  while (length < size && begin[length] != '\0') {
+    ++length;
+  }
+  return std::string(begin, length);
+}
+
+/// @brief Create `directory` and its parents
+bool make_directories(const std::string & directory)
+{
+  for (size_t end = directory.find('/', 1); ; end = directory.find('/', end + 1)) {
+    const std::string parent = directory.substr(0, end);
+    if (-1 == mkdir(parent.c_str(), 0755) && errno != EEXIST) {
+      return false;
+    }
+    if (end == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+}  // namespace
+
+CapabilityCache::CapabilityCache(
+  const std::string & directory, const struct v4l2_capability & capability)
+: m_directory(directory)
+{
+  m_key = to_string(capability.driver, sizeof(capability.driver)) + " " +
+    to_string(capability.card, sizeof(capability.card)) + " " +
+    to_string(capability.bus_info, sizeof(capability.bus_info)) + " " +
+    std::to_string(capability.version);
+}
+
+std::string CapabilityCache::default_directory()
+{
+  const char * cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home != nullptr && cache_home[0] == '/') {
+    return std::string(cache_home) + "/usb_cam";
+  }
+  const char * home = getenv("HOME");
+  if (home != nullptr && home[0] == '/') {
+    return std::string(home) + "/.cache/usb_cam";
+  }
+  return "";
+}
+
+bool CapabilityCache::load_formats(std::vector<capture_format_t> & formats) const
+{
+  return load("formats", formats);
+}
+
+void CapabilityCache::save_formats(const std::vector<capture_format_t> & formats) const
+{
+  save("formats", formats);
+}
+
+bool CapabilityCache::load_controls(std::vector<struct v4l2_query_ext_ctrl> & controls) const
+{
+  return load("controls", controls);
+}
+
+void CapabilityCache::save_controls(
+  const std::vector<struct v4l2_query_ext_ctrl> & controls) const
+{
+  save("controls", controls);
+}
+
+std::string CapabilityCache::path(const std::string & kind) const
+{
+  // Readable file names, the key itself is checked when loading
+  std::string name;
+  for (const char character : m_key) {
+    name += std::isalnum(static_cast<unsigned char>(character)) ? character : '_';
+  }
+  return m_directory + "/" + name + "." + kind;
+}
+
+template<typename T>
+bool CapabilityCache::load(const std::string & kind, std::vector<T> & records) const
+{
+  static_assert(std::is_trivially_copyable<T>::value, "Cached records are stored as is");
+  if (m_directory.empty()) {
+    return false;
+  }
+
+  std::ifstream file(path(kind), std::ios::binary);
+  uint32_t version = 0;
+  uint32_t record_size = 0;
+  uint32_t key_size = 0;
+  uint32_t count = 0;
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(&record_size), sizeof(record_size));
+  file.read(reinterpret_cast<char *>(&key_size), sizeof(key_size));
+  if (!file || version != CACHE_VERSION || record_size != sizeof(T) ||
+    key_size != m_key.size())
+  {
+    return false;
+  }
+  std::string key(key_size, '\0');
+  file.read(&key[0], key_size);
+  file.read(reinterpret_cast<char *>(&count), sizeof(count));
+  if (!file || key != m_key) {
+    return false;
+  }
+  // A truncated or corrupt entry must not make us allocate more than the file holds
+  const std::streampos records_start = file.tellg();
+  file.seekg(0, std::ios::end);
+  const std::streamoff records_size = file.tellg() - records_start;
+  file.seekg(records_start);
+  if (!file || records_size != static_cast<std::streamoff>(count * sizeof(T))) {
+    return false;
+  }
+  std::vector<T> loaded(count);
+  file.read(reinterpret_cast<char *>(loaded.data()), count * sizeof(T));
+  if (!file) {
+    return false;
+  }
+  records.swap(loaded);
+  return true;
+}
+
+template<typename T>
+void CapabilityCache::save(const std::string & kind, const std::vector<T> & records) const
+{
+  if (m_directory.empty() || !make_directories(m_directory)) {
+    return;
+  }
+
+  // Written next to the entry and renamed over it, so that a node starting at the same time
+  // never reads half an entry
+  const std::string entry_path = path(kind);
+  const std::string temporary_path = entry_path + "." + std::to_string(getpid());
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    const uint32_t version = CACHE_VERSION;
+    const uint32_t record_size = sizeof(T);
+    const uint32_t key_size = m_key.size();
+    const uint32_t count = records.size();
+    file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    file.write(reinterpret_cast<const char *>(&record_size), sizeof(record_size));
+    file.write(reinterpret_cast<const char *>(&key_size), sizeof(key_size));
+    file.write(m_key.data(), key_size);
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char *>(records.data()), count * sizeof(T));
+    if (!file) {
+      file.close();
+      unlink(temporary_path.c_str());
+      return;
+    }
+  }
+  if (-1 == rename(temporary_path.c_str(), entry_path.c_str())) {
+    unlink(temporary_path.c_str());
+  }
+}
+
+}  // namespace usb_cam
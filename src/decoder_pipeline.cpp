@@ -0,0 +1,172 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "usb_cam/decoder_pipeline.hpp"
+
+
+namespace usb_cam
+{
+
+DecoderPipeline::DecoderPipeline(
+  const std::vector<std::shared_ptr<pixel_format_base>> & decoders,
+  const size_t & output_size)
+: m_next_slot(0), m_stop(false)
+{
+  for (auto & decoder : decoders) {
+    std::unique_ptr<slot_t> slot(new slot_t());
+    slot->decoder = decoder;
+    slot->bytes_used = 0;
+    slot->output.resize(output_size);
+    slot->sequence = 0;
+    slot->stamp = timespec();
+    slot->occupied = false;
+    slot->decoded = false;
+    slot->converted = false;
+    m_slots.push_back(std::move(slot));
+  }
+  for (auto & slot : m_slots) {
+    slot->thread = std::thread(&DecoderPipeline::worker, this, std::ref(*slot));
+  }
+}
+
+DecoderPipeline::~DecoderPipeline()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  for (auto & slot : m_slots) {
+    slot->work_cv.notify_one();
+  }
+  for (auto & slot : m_slots) {
+    slot->thread.join();
+  }
+}
+
+void DecoderPipeline::submit(
+  const char * src, const size_t & bytes_used,
+  const uint32_t & sequence, const timespec & stamp)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  slot_t & slot = *m_slots[m_next_slot];
+  if (slot.occupied) {
+    throw std::runtime_error("No free decoder slot, pop a frame before submitting another");
+  }
+  // Compressed frames are small, copying them lets the V4L2 buffer be requeued right away
+  slot.input.assign(src, src + bytes_used);
+  slot.bytes_used = bytes_used;
+  slot.sequence = sequence;
+  slot.stamp = stamp;
+  slot.occupied = true;
+  slot.decoded = false;
+  m_next_slot = (m_next_slot + 1) % m_slots.size();
+  lock.unlock();
+  slot.work_cv.notify_one();
+}
+
+bool DecoderPipeline::pop(char * dest, uint32_t & sequence, timespec & stamp)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  // Oldest frame by V4L2 sequence number, compared so that wrap around is handled
+  slot_t * oldest = nullptr;
+  for (auto & slot : m_slots) {
+    if (slot->occupied &&
+      (!oldest || static_cast<int32_t>(slot->sequence - oldest->sequence) < 0))
+    {
+      oldest = slot.get();
+    }
+  }
+  if (!oldest) {
+    return false;
+  }
+
+  m_decoded_cv.wait(lock, [oldest]() {return oldest->decoded;});
+  oldest->occupied = false;
+  oldest->decoded = false;
+  if (!oldest->converted) {
+    return false;
+  }
+  memcpy(dest, oldest->output.data(), oldest->output.size());
+  sequence = oldest->sequence;
+  stamp = oldest->stamp;
+  return true;
+}
+
+void DecoderPipeline::flush()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (auto & slot : m_slots) {
+    slot_t * current = slot.get();
+    m_decoded_cv.wait(lock, [current]() {return !current->occupied || current->decoded;});
+    current->occupied = false;
+    current->decoded = false;
+  }
+  m_next_slot = 0;
+}
+
+size_t DecoderPipeline::in_flight()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t count = 0;
+  for (auto & slot : m_slots) {
+    count += slot->occupied ? 1 : 0;
+  }
+  return count;
+}
+
+void DecoderPipeline::worker(slot_t & slot)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    slot.work_cv.wait(lock, [this, &slot]() {return m_stop || (slot.occupied && !slot.decoded);});
+    if (m_stop) {
+      return;
+    }
+
+    // The slot is only touched by this thread until it is marked as decoded
+    lock.unlock();
+    const char * src = slot.input.data();
+    char * dest = slot.output.data();
+    const bool converted = slot.decoder->convert(src, dest, static_cast<int>(slot.bytes_used));
+    lock.lock();
+
+    slot.converted = converted;
+    slot.decoded = true;
+    m_decoded_cv.notify_all();
+  }
+}
+
+}  // namespace usb_cam
@@ -0,0 +1,92 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "usb_cam/device_watcher.hpp"
+
+
+namespace usb_cam
+{
+
+DeviceWatcher::DeviceWatcher(const std::string & device_path)
+: m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), m_watch(-1)
+{
+  const size_t separator = device_path.rfind('/');
+  const std::string directory = separator == std::string::npos ? "." :
+    separator == 0 ? "/" : device_path.substr(0, separator);
+  m_name = separator == std::string::npos ? device_path : device_path.substr(separator + 1);
+
+  if (m_fd != -1) {
+    m_watch = inotify_add_watch(
+      m_fd, directory.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO);
+  }
+}
+
+DeviceWatcher::~DeviceWatcher()
+{
+  if (m_fd != -1) {
+    close(m_fd);
+  }
+}
+
+bool DeviceWatcher::consume()
+{
+  if (m_fd == -1) {
+    return false;
+  }
+
+  // Aligned for `inotify_event`, large enough for a burst of udev activity
+  alignas(struct inotify_event) char events[4096];
+  bool concerned = false;
+  while (true) {
+    const ssize_t length = read(m_fd, events, sizeof(events));
+    if (length <= 0) {
+      return concerned;
+    }
+    for (ssize_t offset = 0; offset < length; ) {
+      const auto event = reinterpret_cast<const struct inotify_event *>(events + offset);
+      if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+        // Events were lost, or the directory is gone and nothing will be reported anymore
+        if (event->mask & IN_IGNORED) {
+          m_watch = -1;
+        }
+        concerned = true;
+      } else if (event->len > 0 && m_name == event->name) {
+        concerned = true;
+      }
+      offset += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+}  // namespace usb_cam
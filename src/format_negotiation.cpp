@@ -0,0 +1,200 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "usb_cam/format_negotiation.hpp"
+
+
+namespace usb_cam
+{
+
+namespace
+{
+
+/// @brief A conversion `choose_pixel_format` can pick
+typedef struct
+{
+  const char * pixel_format_name;
+  uint32_t v4l2;
+  const char * output_encoding;
+  // bytes per pixel sent over the bus, MJPEG is a typical rate at the default UVC quality
+  double bus_bytes_per_pixel;
+  // rough conversion time per pixel, relative to converting YUYV to RGB
+  double cpu_cost_per_pixel;
+} conversion_t;
+
+// `rgb8` is left out on purpose, it captures RGB332
+const conversion_t CONVERSIONS[] = {
+  {"yuyv2rgb", V4L2_PIX_FMT_YUYV, "rgb8", 2.0, 1.0},
+  {"uyvy2rgb", V4L2_PIX_FMT_UYVY, "rgb8", 2.0, 1.0},
+  {"yvyu2rgb", V4L2_PIX_FMT_YVYU, "rgb8", 2.0, 1.0},
+  {"m4202rgb", V4L2_PIX_FMT_M420, "rgb8", 1.5, 1.5},
+  {"mjpeg2rgb", V4L2_PIX_FMT_MJPEG, "rgb8", 0.3, 5.0},
+  {"mono8", V4L2_PIX_FMT_GREY, "mono8", 1.0, 0.1},
+  {"y102mono8", V4L2_PIX_FMT_Y10, "mono8", 2.0, 0.5},
+  {"mjpeg2mono8", V4L2_PIX_FMT_MJPEG, "mono8", 0.3, 3.0},
+};
+
+/// @return the highest frame rate of `format`
+double max_frame_rate(const capture_format_t & format)
+{
+  const struct v4l2_fract & interval = format.v4l2_fmt.type == V4L2_FRMIVAL_TYPE_DISCRETE ?
+    format.v4l2_fmt.discrete : format.v4l2_fmt.stepwise.min;
+  if (interval.numerator == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(interval.denominator) / interval.numerator;
+}
+
+/// @return true if `format` was enumerated at, or covers, `width` x `height`
+bool has_size(const capture_format_t & format, int width, int height)
+{
+  const uint32_t w = static_cast<uint32_t>(width);
+  const uint32_t h = static_cast<uint32_t>(height);
+  if (format.size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+    return format.v4l2_fmt.width == w && format.v4l2_fmt.height == h;
+  }
+  // Ranges are listed at their smallest and largest size, the largest has the lowest
+  // frame rates, so only count that one
+  const struct v4l2_frmsize_stepwise & range = format.size.stepwise;
+  if (format.v4l2_fmt.width != range.max_width || format.v4l2_fmt.height != range.max_height) {
+    return false;
+  }
+  const uint32_t step_width = std::max<uint32_t>(range.step_width, 1);
+  const uint32_t step_height = std::max<uint32_t>(range.step_height, 1);
+  return w >= range.min_width && w <= range.max_width &&
+         h >= range.min_height && h <= range.max_height &&
+         (w - range.min_width) % step_width == 0 && (h - range.min_height) % step_height == 0;
+}
+
+}  // namespace
+
+format_choice_t choose_pixel_format(
+  const std::vector<capture_format_t> & formats, int width, int height, int framerate,
+  double usb_bandwidth)
+{
+  const double pixels = static_cast<double>(width) * height;
+  const double rate = std::max(framerate, 1);
+
+  std::vector<format_choice_t> candidates;
+  std::vector<bool> qualifies;
+  for (const auto & conversion : CONVERSIONS) {
+    double frame_rate = 0.0;
+    for (const auto & format : formats) {
+      if (format.format.pixelformat == conversion.v4l2 && has_size(format, width, height)) {
+        frame_rate = std::max(frame_rate, max_frame_rate(format));
+      }
+    }
+    if (frame_rate == 0.0) {
+      continue;
+    }
+
+    format_choice_t candidate;
+    candidate.pixel_format_name = conversion.pixel_format_name;
+    candidate.output_encoding = conversion.output_encoding;
+    candidate.frame_rate = frame_rate;
+    candidate.bandwidth = pixels * conversion.bus_bytes_per_pixel * rate;
+    candidate.cpu_cost = pixels * conversion.cpu_cost_per_pixel * rate;
+    candidates.push_back(candidate);
+    qualifies.push_back(frame_rate >= rate && candidate.bandwidth <= usb_bandwidth);
+  }
+
+  if (candidates.empty()) {
+    throw std::invalid_argument(
+            "No supported pixel format at " + std::to_string(width) + "x" +
+            std::to_string(height));
+  }
+
+  // Among the qualifying candidates: color before mono, then cheapest to convert, then
+  // lightest on the bus. Without any, the one closest to the requested frame rate.
+  size_t best = candidates.size();
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (!qualifies[i]) {
+      continue;
+    }
+    if (best == candidates.size()) {
+      best = i;
+      continue;
+    }
+    const bool color = candidates[i].output_encoding == "rgb8";
+    const bool best_color = candidates[best].output_encoding == "rgb8";
+    if (color != best_color) {
+      if (color) {
+        best = i;
+      }
+    } else if (candidates[i].cpu_cost < candidates[best].cpu_cost ||
+      (candidates[i].cpu_cost == candidates[best].cpu_cost &&
+      candidates[i].bandwidth < candidates[best].bandwidth))
+    {
+      best = i;
+    }
+  }
+
+  std::ostringstream reason;
+  if (best == candidates.size()) {
+    best = 0;
+    for (size_t i = 1; i < candidates.size(); ++i) {
+      if (candidates[i].frame_rate > candidates[best].frame_rate) {
+        best = i;
+      }
+    }
+    reason << "no format delivers " << width << "x" << height << " at " << framerate <<
+      " fps within " << usb_bandwidth / 1e6 << " MB/s of USB bandwidth, the fastest does " <<
+      candidates[best].frame_rate << " fps";
+  } else {
+    reason << "lowest conversion cost of the formats delivering " << width << "x" << height <<
+      " at " << framerate << " fps (" << candidates[best].bandwidth / 1e6 << " of " <<
+      usb_bandwidth / 1e6 << " MB/s of USB bandwidth)";
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (i == best) {
+        continue;
+      }
+      reason << "; " << candidates[i].pixel_format_name;
+      if (candidates[i].frame_rate < rate) {
+        reason << " only does " << candidates[i].frame_rate << " fps";
+      } else if (candidates[i].bandwidth > usb_bandwidth) {
+        reason << " needs " << candidates[i].bandwidth / 1e6 << " MB/s";
+      } else if (candidates[i].output_encoding != candidates[best].output_encoding) {
+        reason << " outputs " << candidates[i].output_encoding;
+      } else {
+        reason << " costs " << candidates[i].cpu_cost / candidates[best].cpu_cost << "x";
+      }
+    }
+  }
+  candidates[best].reason = reason.str();
+  return candidates[best];
+}
+
+}  // namespace usb_cam
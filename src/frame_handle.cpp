@@ -0,0 +1,83 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "usb_cam/frame_handle.hpp"
+#include "usb_cam/usb_cam.hpp"
+
+
+namespace usb_cam
+{
+
+FrameHandle::FrameHandle()
+: m_camera(nullptr), m_generation(0), m_buffer(), m_data(nullptr), m_stride(0), m_stamp()
+{}
+
+FrameHandle::FrameHandle(
+  UsbCam * camera, const uint64_t & generation, const struct v4l2_buffer & buffer,
+  const char * data, const size_t & stride, const timespec & stamp)
+: m_camera(camera), m_generation(generation), m_buffer(buffer), m_data(data),
+  m_stride(stride), m_stamp(stamp)
+{}
+
+FrameHandle::~FrameHandle()
+{
+  release();
+}
+
+FrameHandle::FrameHandle(FrameHandle && other) noexcept
+: m_camera(other.m_camera), m_generation(other.m_generation), m_buffer(other.m_buffer),
+  m_data(other.m_data), m_stride(other.m_stride), m_stamp(other.m_stamp)
+{
+  other.m_data = nullptr;
+}
+
+FrameHandle & FrameHandle::operator=(FrameHandle && other) noexcept
+{
+  if (this != &other) {
+    release();
+    m_camera = other.m_camera;
+    m_generation = other.m_generation;
+    m_buffer = other.m_buffer;
+    m_data = other.m_data;
+    m_stride = other.m_stride;
+    m_stamp = other.m_stamp;
+    other.m_data = nullptr;
+  }
+  return *this;
+}
+
+void FrameHandle::release()
+{
+  if (m_data == nullptr) {
+    return;
+  }
+  m_data = nullptr;
+  m_camera->release_frame(m_buffer.index, m_generation);
+}
+
+}  // namespace usb_cam
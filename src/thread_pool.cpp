@@ -0,0 +1,123 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "usb_cam/thread_pool.hpp"
+
+
+namespace usb_cam
+{
+
+ThreadPool::ThreadPool(const size_t & number_of_threads)
+: m_task(nullptr), m_number_of_tasks(0), m_next_task(0), m_exception(nullptr),
+  m_generation(0), m_busy_workers(0), m_stop(false)
+{
+  for (size_t i = 1; i < number_of_threads; ++i) {
+    m_workers.emplace_back(&ThreadPool::worker, this);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_work_cv.notify_all();
+  for (auto & worker : m_workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run(const size_t & number_of_tasks, const std::function<void(size_t)> & task)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  // Workers that woke up too late for the previous batch may still be on their way out
+  m_done_cv.wait(lock, [this]() {return m_busy_workers == 0;});
+
+  m_task = &task;
+  m_number_of_tasks = number_of_tasks;
+  m_next_task = 0;
+  m_exception = nullptr;
+  ++m_generation;
+  lock.unlock();
+  m_work_cv.notify_all();
+
+  run_tasks();
+
+  // Once every task is claimed, only the workers still busy can be running one
+  lock.lock();
+  m_done_cv.wait(lock, [this]() {return m_busy_workers == 0;});
+  m_task = nullptr;
+
+  if (m_exception) {
+    std::rethrow_exception(m_exception);
+  }
+}
+
+void ThreadPool::run_tasks()
+{
+  for (size_t i = m_next_task++; i < m_number_of_tasks; i = m_next_task++) {
+    try {
+      (*m_task)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_exception) {
+        m_exception = std::current_exception();
+      }
+    }
+  }
+}
+
+void ThreadPool::worker()
+{
+  uint64_t last_generation = 0;
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_work_cv.wait(lock, [&]() {return m_stop || m_generation != last_generation;});
+    if (m_stop) {
+      return;
+    }
+    last_generation = m_generation;
+    ++m_busy_workers;
+    lock.unlock();
+
+    run_tasks();
+
+    lock.lock();
+    if (--m_busy_workers == 0) {
+      m_done_cv.notify_all();
+    }
+  }
+}
+
+}  // namespace usb_cam
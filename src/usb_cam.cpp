@@ -31,12 +31,15 @@
 extern "C" {
 #include <linux/videodev2.h>  // Defines V4L2 format constants
 #include <malloc.h>  // for memalign and malloc
+#include <sys/epoll.h>  // for epoll_create1, epoll_ctl and epoll_wait
+#include <sys/eventfd.h>  // for eventfd
 #include <sys/mman.h>  // for mmap
 #include <sys/stat.h>  // for stat
 #include <unistd.h>  // for getpagesize()
 #include <fcntl.h>  // for O_* constants and open()
 }
 
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <iostream>
@@ -56,12 +59,18 @@ namespace usb_cam
 
 using utils::io_method_t;
 
+/// @brief How often to try reopening a lost device when no event says it is back
+const int RECONNECT_INTERVAL_MS = 250;
+/// @brief Least time without a frame before reporting a stall, whatever the frame rate:
+/// some UVC cameras take over a second to deliver the first frame after STREAMON
+const int MIN_STALL_TIMEOUT_MS = 2000;
 
 UsbCam::UsbCam()
-: m_io(io_method_t::IO_METHOD_MMAP), m_fd(-1),
-  m_buffers(NULL), m_number_of_buffers(0), m_image(), m_parameters(),
+: m_io(io_method_t::IO_METHOD_MMAP), m_fd(-1), m_epoll_fd(-1), m_wakeup_fd(-1),
+  m_release_fd(-1), m_frame_period_us(0), m_buffers(NULL), m_number_of_buffers(0),
+  m_user_buffers(false), m_buffer_generation(0), m_buffer_depth(0), m_image(), m_parameters(),
   m_avframe(NULL), m_avcodec(NULL), m_avoptions(NULL),
-  m_avcodec_context(NULL), m_is_capturing(false),
+  m_avcodec_context(NULL), m_is_capturing(false), m_device_lost(false),
   m_epoch_time_shift(usb_cam::utils::get_epoch_time_shift()), m_supported_formats()
 {}
 
@@ -77,19 +86,110 @@ UsbCam::~UsbCam()
 /// @param src a pointer to a V4L2 source image
 /// @param dest a pointer to where the source image should be copied (if required)
 /// @param bytes_used number of bytes used by the src buffer
-void UsbCam::process_image(const char * src, char * & dest, const int & bytes_used)
+/// @return true if `dest` now holds a new image, false if the frame was only queued
+/// for decoding (see `DecoderPipeline`) or was dropped because it could not be decoded
+bool UsbCam::process_image(const char * src, char * & dest, const int & bytes_used)
 {
-  // TODO(flynneva): could we skip the copy here somehow?
+  // The V4L2 buffer is queued again right after, so the image needs its own copy. Callers
+  // that can hold the buffer instead use `get_frame`.
   // If no conversion required, just copy the image from V4L2 buffer
-  if (m_image.pixel_format->requires_conversion() == false) {
+  m_image.bytes_used = m_image.size_in_bytes;
+  if (m_image.pixel_format->is_compressed()) {
+    // Compressed frames vary in size, only copy what the driver filled in. The buffer holds
+    // the most the driver said it would fill in, a truncated frame would be undecodable.
+    if (static_cast<size_t>(bytes_used) > m_image.size_in_bytes) {
+      m_stats.record_corrupt();
+      return false;
+    }
+    m_image.bytes_used = bytes_used;
+    memcpy(dest, src, m_image.bytes_used);
+  } else if (m_image.pixel_format->requires_conversion() == false) {
     memcpy(dest, src, m_image.size_in_bytes);
-  } else {
-    m_image.pixel_format->convert(src, dest, bytes_used);
+  } else if (m_decoder_pipeline) {
+    // Queue this frame and hand back the oldest one once every decoder is busy
+    m_decoder_pipeline->submit(src, bytes_used, m_image.sequence, m_image.stamp);
+    if (m_decoder_pipeline->in_flight() < m_decoder_pipeline->depth()) {
+      return false;
+    }
+    if (!m_decoder_pipeline->pop(dest, m_image.sequence, m_image.stamp)) {
+      m_stats.record_corrupt();
+      return false;
+    }
+  } else if (m_conversion_pool) {
+    // Split the frame into one band of whole rows per thread
+    const size_t number_of_bands = m_conversion_pool->size();
+    const size_t rows_per_band = (m_image.height + number_of_bands - 1) / number_of_bands;
+    m_conversion_pool->run(
+      number_of_bands, [this, src, dest, rows_per_band](size_t band) {
+        const size_t first_row = band * rows_per_band;
+        if (first_row >= m_image.height) {
+          return;
+        }
+        const size_t number_of_rows = std::min(rows_per_band, m_image.height - first_row);
+        m_image.pixel_format->convert_band(
+          src, dest, first_row * m_image.width, number_of_rows * m_image.width);
+      });
+  } else if (!m_image.pixel_format->convert(src, dest, bytes_used)) {
+    // Publishing the previous image again with this frame's stamp would hide the loss
+    m_stats.record_corrupt();
+    return false;
+  }
+  return true;
+}
+
+/// @brief Dequeue the oldest ready buffer. `buf.type` and `buf.memory` must be set.
+/// @return false if no buffer is ready
+bool UsbCam::dequeue_buffer(struct v4l2_buffer & buf)
+{
+  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_DQBUF), &buf)) {
+    switch (errno) {
+      case EAGAIN:
+        return false;
+      case ENODEV:
+        // Unplugged or reset, see `lose_device`
+        m_device_lost = true;
+        return false;
+      default:
+        throw std::runtime_error("Unable to retrieve frame from the driver");
+    }
   }
+  const int64_t lag_us = get_buffer_lag_us(buf);
+  m_stats.record_dequeue(buf.sequence, buf.flags, lag_us);
+  if (m_buffer_depth_policy) {
+    const unsigned int depth = m_buffer_depth_policy->update(
+      m_buffer_depth, buf.sequence, lag_us, m_frame_period_us);
+    if (depth != m_buffer_depth) {
+      set_buffer_depth(depth);
+      std::cout << "Cycling " << m_buffer_depth << " buffers through the driver" << std::endl;
+    }
+  }
+  return true;
 }
 
-void UsbCam::read_frame()
+/// @brief Replace the dequeued `buf` with the newest ready buffer, handing every older
+/// one straight back to the driver without converting it
+void UsbCam::dequeue_latest_buffer(struct v4l2_buffer & buf)
 {
+  struct v4l2_buffer newer;
+  CLEAR(newer);
+  newer.type = buf.type;
+  newer.memory = buf.memory;
+
+  while (dequeue_buffer(newer)) {
+    queue_buffer(buf.index);
+    m_stats.record_skip();
+    buf = newer;
+    CLEAR(newer);
+    newer.type = buf.type;
+    newer.memory = buf.memory;
+  }
+}
+
+/// @brief Read a frame from the device into `m_image.data`
+/// @return true if `m_image.data` holds a new image
+bool UsbCam::read_frame()
+{
+  bool new_image;
   struct v4l2_buffer buf;
   unsigned int i;
   int len;
@@ -100,7 +200,10 @@ void UsbCam::read_frame()
       if (len == -1) {
         switch (errno) {
           case EAGAIN:
-            return;
+            return false;
+          case ENODEV:
+            m_device_lost = true;
+            return false;
           default:
             throw std::runtime_error("Unable to read frame");
         }
@@ -109,81 +212,67 @@ void UsbCam::read_frame()
     case io_method_t::IO_METHOD_MMAP:
       CLEAR(buf);
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      m_image.v4l2_fmt.type = buf.type;
       buf.memory = V4L2_MEMORY_MMAP;
 
-      // Get current v4l2 pixel format
-      if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_G_FMT), &m_image.v4l2_fmt)) {
-        switch (errno) {
-          case EAGAIN:
-            return;
-          default:
-            throw std::runtime_error("Invalid v4l2 format");
-        }
-      }
+      // The format negotiated in `init_device` stays valid until the driver reports a
+      // source change (see `handle_events`), so this is the only ioctl before the QBUF
       /// Dequeue buffer with the new image
-      if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_DQBUF), &buf)) {
-        switch (errno) {
-          case EAGAIN:
-            return;
-          default:
-            throw std::runtime_error("Unable to retrieve frame with mmap");
-        }
+      if (!dequeue_buffer(buf)) {
+        return false;
+      }
+      if (m_parameters.latest_frame_only) {
+        dequeue_latest_buffer(buf);
       }
 
       // Get timestamp from V4L2 image buffer
-      m_buffer_time_s =
-        buf.timestamp.tv_sec + static_cast<int64_t>(round(buf.timestamp.tv_usec / 1000000.0));
+      m_image.stamp = get_buffer_stamp(buf);
 
-      m_image.stamp.tv_sec = static_cast<time_t>(round(m_buffer_time_s)) + m_epoch_time_shift;
-      m_image.stamp.tv_nsec = static_cast<int64_t>(buf.timestamp.tv_usec * 1000.0);
+      m_image.sequence = buf.sequence;
 
-      assert(buf.index < m_number_of_buffers);
-      process_image(m_buffers[buf.index].start, m_image.data, buf.bytesused);
+      if (buf.index >= m_number_of_buffers) {
+        throw std::runtime_error("Driver returned a buffer that was never queued");
+      }
+      new_image = process_image(m_buffers[buf.index].start, m_image.data, buf.bytesused);
 
       /// Requeue buffer so it can be reused
-      if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QBUF), &buf)) {
-        throw std::runtime_error("Unable to exchange buffer with the driver");
-      }
-      return;
+      queue_buffer(buf.index);
+      return new_image;
     case io_method_t::IO_METHOD_USERPTR:
       CLEAR(buf);
 
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
       buf.memory = V4L2_MEMORY_USERPTR;
 
-      if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_DQBUF), &buf)) {
-        switch (errno) {
-          case EAGAIN:
-            return;
-          default:
-            throw std::runtime_error("Unable to exchange buffer with driver");
-        }
+      if (!dequeue_buffer(buf)) {
+        return false;
+      }
+      if (m_parameters.latest_frame_only) {
+        dequeue_latest_buffer(buf);
       }
 
-      m_buffer_time_s =
-        buf.timestamp.tv_sec + static_cast<int64_t>(round(buf.timestamp.tv_usec / 1000000.0));
-
-      m_image.stamp.tv_sec = static_cast<time_t>(round(m_buffer_time_s)) + m_epoch_time_shift;
-      m_image.stamp.tv_nsec = static_cast<int64_t>(buf.timestamp.tv_usec / 1000.0);
+      m_image.stamp = get_buffer_stamp(buf);
 
       for (i = 0; i < m_number_of_buffers; ++i) {
         if (buf.m.userptr == reinterpret_cast<uint64_t>(m_buffers[i].start) && \
           buf.length == m_buffers[i].length)
         {
-          return;
+          break;
         }
       }
 
-      assert(i < m_number_of_buffers);
-      process_image(reinterpret_cast<const char *>(buf.m.userptr), m_image.data, buf.bytesused);
-      if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QBUF), &buf)) {
-        throw std::runtime_error("Unable to exchange buffer with driver");
+      m_image.sequence = buf.sequence;
+
+      if (i == m_number_of_buffers) {
+        throw std::runtime_error("Driver returned a buffer that was never queued");
       }
-      return;
+      new_image = process_image(
+        reinterpret_cast<const char *>(buf.m.userptr), m_image.data, buf.bytesused);
+      queue_buffer(i);
+      return new_image;
     case io_method_t::IO_METHOD_UNKNOWN:
       throw std::invalid_argument("IO method unknown");
   }
+  return false;
 }
 
 void UsbCam::stop_capturing()
@@ -191,6 +280,10 @@ void UsbCam::stop_capturing()
   if (!m_is_capturing) {return;}
 
   m_is_capturing = false;
+  if (m_device_watcher) {
+    // Streaming stopped with the device, just don't resume it when reconnecting
+    return;
+  }
   enum v4l2_buf_type type;
 
   switch (m_io) {
@@ -205,6 +298,10 @@ void UsbCam::stop_capturing()
         m_is_capturing = true;
         throw std::runtime_error("Unable to stop capturing stream");
       }
+      // Frames still being decoded belong to the stream we just stopped
+      if (m_decoder_pipeline) {
+        m_decoder_pipeline->flush();
+      }
       return;
     case io_method_t::IO_METHOD_UNKNOWN:
       throw std::invalid_argument("IO method unknown");
@@ -214,6 +311,11 @@ void UsbCam::stop_capturing()
 void UsbCam::start_capturing()
 {
   if (m_is_capturing) {return;}
+  if (m_device_watcher && m_fd == -1) {
+    // Resumed once the device is back, see `reconnect`
+    m_is_capturing = true;
+    return;
+  }
 
   unsigned int i;
   enum v4l2_buf_type type;
@@ -223,45 +325,20 @@ void UsbCam::start_capturing()
       /* Nothing to do. */
       break;
     case io_method_t::IO_METHOD_MMAP:
-      // Queue the buffers
-      for (i = 0; i < m_number_of_buffers; ++i) {
-        struct v4l2_buffer buf;
-        CLEAR(buf);
-
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-
-        if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QBUF), &buf)) {
-          throw std::runtime_error("Unable to queue image buffer");
-        }
-      }
-
-      // Start the stream
-      type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      if (-1 == usb_cam::utils::xioctl(m_fd, VIDIOC_STREAMON, &type)) {
-        throw std::runtime_error("Unable to start stream");
-      }
-      break;
     case io_method_t::IO_METHOD_USERPTR:
+      // Queue the buffers, `queue_buffer` holds back those beyond `m_buffer_depth`. Buffers
+      // of frames that are still held are queued once released, see `release_frame`.
+      m_parked_buffers.clear();
+      m_stats.restart_sequence();
+      requeue_released_buffers();
       for (i = 0; i < m_number_of_buffers; ++i) {
-        struct v4l2_buffer buf;
-
-        CLEAR(buf);
-
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_USERPTR;
-        buf.index = i;
-        buf.m.userptr = reinterpret_cast<uint64_t>(m_buffers[i].start);
-        buf.length = m_buffers[i].length;
-
-        if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QBUF), &buf)) {
-          throw std::runtime_error("Unable to configure stream");
+        if (std::find(m_held_buffers.begin(), m_held_buffers.end(), i) == m_held_buffers.end()) {
+          queue_buffer(i);
         }
       }
 
+      // Start the stream
       type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
       if (-1 == usb_cam::utils::xioctl(m_fd, VIDIOC_STREAMON, &type)) {
         throw std::runtime_error("Unable to start stream");
       }
@@ -276,12 +353,28 @@ void UsbCam::uninit_device()
 {
   unsigned int i;
 
+  // Caller owned buffers outlive a lost device and are registered again once it is back,
+  // see `reconnect`, so frames taken from them stay valid
+  if (m_lost_user_buffers.empty()) {
+    ++m_buffer_generation;
+    m_held_buffers.clear();
+  }
+  if (m_buffers == NULL) {
+    // Never set up, or already released with a lost device
+    free(m_image.data);
+    return;
+  }
+
   switch (m_io) {
     case io_method_t::IO_METHOD_READ:
       free(m_buffers[0].start);
       break;
     case io_method_t::IO_METHOD_MMAP:
       for (i = 0; i < m_number_of_buffers; ++i) {
+        // Importers hold their own reference to an exported buffer, closing ours is enough
+        if (m_buffers[i].dmabuf_fd != -1) {
+          close(m_buffers[i].dmabuf_fd);
+        }
         if (-1 == munmap(m_buffers[i].start, m_buffers[i].length)) {
           // TODO(flynneva): is this the right error to throw here?
           throw std::runtime_error("Unable to deallocate memory");
@@ -289,7 +382,8 @@ void UsbCam::uninit_device()
       }
       break;
     case io_method_t::IO_METHOD_USERPTR:
-      for (i = 0; i < m_number_of_buffers; ++i) {
+      // Buffers passed to `set_user_buffers` belong to the caller
+      for (i = 0; m_user_buffers == false && i < m_number_of_buffers; ++i) {
         free(m_buffers[i].start);
       }
       break;
@@ -310,8 +404,10 @@ void UsbCam::init_read()
     throw std::overflow_error("Out of memory");
   }
 
-  m_buffers[0].length = m_image.size_in_bytes;
-  m_buffers[0].start = reinterpret_cast<char *>(malloc(m_image.size_in_bytes));
+  // Sized for the captured frame, which can be larger than the published image
+  const size_t buffer_size = get_capture_buffer_size();
+  m_buffers[0].length = buffer_size;
+  m_buffers[0].start = reinterpret_cast<char *>(malloc(buffer_size));
 
   if (!m_buffers[0].start) {
     throw std::overflow_error("Out of memory");
@@ -324,7 +420,7 @@ void UsbCam::init_mmap()
 
   CLEAR(req);
 
-  req.count = 4;
+  req.count = std::max(m_parameters.buffer_count, 1);
   req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   req.memory = V4L2_MEMORY_MMAP;
 
@@ -347,68 +443,280 @@ void UsbCam::init_mmap()
   }
 
   for (uint32_t current_buffer = 0; current_buffer < req.count; ++current_buffer) {
+    init_buffer(current_buffer);
+  }
+  m_number_of_buffers = req.count;
+  m_buffer_depth = req.count;
+}
+
+void UsbCam::init_userp()
+{
+  struct v4l2_requestbuffers req;
+
+  CLEAR(req);
+
+  req.count = std::max(m_parameters.buffer_count, 1);
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_USERPTR;
+
+  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_REQBUFS), &req)) {
+    if (EINVAL == errno) {
+      throw std::invalid_argument("Device does not support user pointer i/o");
+    } else {
+      throw std::invalid_argument("Unable to initialize memory mapping");
+    }
+  }
+
+  m_buffers = reinterpret_cast<usb_cam::utils::buffer *>(calloc(req.count, sizeof(*m_buffers)));
+
+  if (!m_buffers) {
+    throw std::overflow_error("Out of memory");
+  }
+
+  for (uint32_t current_buffer = 0; current_buffer < req.count; ++current_buffer) {
+    init_buffer(current_buffer);
+  }
+  m_number_of_buffers = req.count;
+  m_buffer_depth = req.count;
+  m_user_buffers = false;
+}
+
+/// @brief Map (mmap) or allocate (userptr) the memory of buffer `index`
+void UsbCam::init_buffer(uint32_t index)
+{
+  if (m_io == io_method_t::IO_METHOD_MMAP) {
     struct v4l2_buffer buf;
 
     CLEAR(buf);
 
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buf.memory = V4L2_MEMORY_MMAP;
-    buf.index = current_buffer;
+    buf.index = index;
 
     if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QUERYBUF), &buf)) {
       throw std::runtime_error("Unable to query status of buffer");
     }
 
-    m_buffers[current_buffer].length = buf.length;
-    m_buffers[current_buffer].start =
+    m_buffers[index].length = buf.length;
+    m_buffers[index].dmabuf_fd = -1;
+    m_buffers[index].start =
       reinterpret_cast<char *>(mmap(
         NULL /* start anywhere */, buf.length, PROT_READ | PROT_WRITE /* required */,
         MAP_SHARED /* recommended */, m_fd, buf.m.offset));
 
-    if (MAP_FAILED == m_buffers[current_buffer].start) {
+    if (MAP_FAILED == m_buffers[index].start) {
       throw std::runtime_error("Unable to allocate memory for image buffers");
     }
+  } else {
+    const unsigned int page_size = getpagesize();
+    // Sized for the captured frame, which can be larger than the published image
+    const size_t buffer_size = (get_capture_buffer_size() + page_size - 1) & ~(page_size - 1);
+
+    m_buffers[index].length = buffer_size;
+    m_buffers[index].dmabuf_fd = -1;
+    m_buffers[index].start =
+      reinterpret_cast<char *>(memalign(/* boundary */ page_size, buffer_size));
+
+    if (!m_buffers[index].start) {
+      throw std::overflow_error("Out of memory");
+    }
   }
-  m_number_of_buffers = req.count;
 }
 
-void UsbCam::init_userp()
+/// @brief Add up to `count` buffers with `VIDIOC_CREATE_BUFS`, which works while streaming
+/// @return the number of buffers added, 0 if the driver can't add any
+unsigned int UsbCam::create_buffers(unsigned int count)
 {
-  struct v4l2_requestbuffers req;
-  unsigned int page_size;
+  struct v4l2_create_buffers create;
 
-  page_size = getpagesize();
-  auto buffer_size = (m_image.size_in_bytes + page_size - 1) & ~(page_size - 1);
+  CLEAR(create);
 
-  CLEAR(req);
+  create.count = count;
+  create.memory = m_io == io_method_t::IO_METHOD_MMAP ?
+    V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+  create.format = m_image.v4l2_fmt;
 
-  req.count = 4;
-  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  req.memory = V4L2_MEMORY_USERPTR;
+  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_CREATE_BUFS), &create) ||
+    create.count == 0)
+  {
+    return 0;
+  }
 
-  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_REQBUFS), &req)) {
-    if (EINVAL == errno) {
-      throw std::invalid_argument("Device does not support user pointer i/o");
-    } else {
-      throw std::invalid_argument("Unable to initialize memory mapping");
+  auto buffers = reinterpret_cast<usb_cam::utils::buffer *>(
+    realloc(m_buffers, (create.index + create.count) * sizeof(*m_buffers)));
+  if (!buffers) {
+    throw std::overflow_error("Out of memory");
+  }
+  m_buffers = buffers;
+  for (uint32_t index = create.index; index < create.index + create.count; ++index) {
+    init_buffer(index);
+  }
+  m_number_of_buffers = create.index + create.count;
+  return create.count;
+}
+
+/// @brief Hand buffer `index` to the driver, or hold it back while more than
+/// `m_buffer_depth` buffers are cycled through the driver
+void UsbCam::queue_buffer(uint32_t index)
+{
+  if (m_number_of_buffers - m_parked_buffers.size() > m_buffer_depth) {
+    m_parked_buffers.push_back(index);
+    return;
+  }
+
+  struct v4l2_buffer buf;
+  CLEAR(buf);
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.index = index;
+  if (m_io == io_method_t::IO_METHOD_MMAP) {
+    buf.memory = V4L2_MEMORY_MMAP;
+  } else {
+    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.m.userptr = reinterpret_cast<uint64_t>(m_buffers[index].start);
+    buf.length = m_buffers[index].length;
+  }
+  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QBUF), &buf)) {
+    if (ENODEV == errno) {
+      // The buffer is gone with the device
+      m_device_lost = true;
+      return;
     }
+    throw std::runtime_error("Unable to exchange buffer with the driver");
   }
+}
 
-  m_buffers = reinterpret_cast<usb_cam::utils::buffer *>(calloc(req.count, sizeof(*m_buffers)));
+/// @brief Queue the buffers handed back by `release_frame` since the last call. Capturing
+/// thread only.
+void UsbCam::requeue_released_buffers()
+{
+  std::vector<std::pair<uint32_t, uint64_t>> released;
+  {
+    std::lock_guard<std::mutex> lock(m_released_mutex);
+    released.swap(m_released_buffers);
+    uint64_t count;
+    if (m_release_fd != -1 && -1 == read(m_release_fd, &count, sizeof(count))) {
+      // Nothing was released since the last call
+    }
+  }
 
-  if (!m_buffers) {
-    throw std::overflow_error("Out of memory");
+  for (const auto & buffer : released) {
+    if (buffer.second != m_buffer_generation) {
+      // Freed or replaced since the frame was taken
+      continue;
+    }
+    m_held_buffers.erase(
+      std::remove(m_held_buffers.begin(), m_held_buffers.end(), buffer.first),
+      m_held_buffers.end());
+    // Otherwise queued once capturing starts, or resumes with the device back
+    if (buffer.first < m_number_of_buffers && m_is_capturing && !m_device_watcher) {
+      queue_buffer(buffer.first);
+    }
   }
+}
 
-  for (uint32_t current_buffer = 0; current_buffer < req.count; ++current_buffer) {
-    m_buffers[current_buffer].length = buffer_size;
-    m_buffers[current_buffer].start =
-      reinterpret_cast<char *>(memalign(/* boundary */ page_size, buffer_size));
+void UsbCam::release_frame(uint32_t index, uint64_t generation)
+{
+  std::lock_guard<std::mutex> lock(m_released_mutex);
+  m_released_buffers.emplace_back(index, generation);
+  const uint64_t count = 1;
+  if (m_release_fd != -1 && -1 == write(m_release_fd, &count, sizeof(count))) {
+    // Only fails if the counter would overflow, i.e. a wake up is already pending
+  }
+}
 
-    if (!m_buffers[current_buffer].start) {
-      throw std::overflow_error("Out of memory");
+void UsbCam::set_buffer_depth(unsigned int depth)
+{
+  if (m_io == io_method_t::IO_METHOD_READ || m_io == io_method_t::IO_METHOD_UNKNOWN) {
+    return;
+  }
+  depth = std::max(depth, 2u);
+  // Caller owned buffers can't be added to
+  if (depth > m_number_of_buffers && !m_user_buffers) {
+    const unsigned int first_created = m_number_of_buffers;
+    const unsigned int created = create_buffers(depth - m_number_of_buffers);
+    for (uint32_t index = first_created; index < first_created + created; ++index) {
+      // Queued when capturing starts otherwise
+      if (m_is_capturing) {
+        m_parked_buffers.push_back(index);
+      }
+    }
+  }
+  m_buffer_depth = std::min(depth, m_number_of_buffers);
+
+  // Hand held back buffers to the driver until `m_buffer_depth` are cycled, surplus ones are
+  // held back as they are dequeued
+  while (m_is_capturing && !m_parked_buffers.empty() &&
+    m_number_of_buffers - m_parked_buffers.size() < m_buffer_depth)
+  {
+    const uint32_t index = m_parked_buffers.back();
+    m_parked_buffers.pop_back();
+    queue_buffer(index);
+  }
+}
+
+void UsbCam::set_user_buffers(const std::vector<usb_cam::utils::buffer> & buffers)
+{
+  register_user_buffers(buffers);
+  // Frames taken from the previous buffers must not be queued into these
+  ++m_buffer_generation;
+  m_held_buffers.clear();
+}
+
+/// @brief Replace the buffers with `buffers`, keeping frames taken from the current ones
+/// valid, for registering the same buffers again with a reopened device
+void UsbCam::register_user_buffers(const std::vector<usb_cam::utils::buffer> & buffers)
+{
+  if (m_io != io_method_t::IO_METHOD_USERPTR) {
+    throw std::invalid_argument("User buffers require the userptr IO method");
+  }
+  if (m_is_capturing) {
+    throw std::runtime_error("Unable to replace buffers while capturing");
+  }
+  if (buffers.empty()) {
+    throw std::invalid_argument("At least one user buffer is required");
+  }
+  for (const auto & buffer : buffers) {
+    if (buffer.start == nullptr || buffer.length < get_capture_buffer_size()) {
+      throw std::invalid_argument(
+              "User buffers must hold at least " + std::to_string(get_capture_buffer_size()) +
+              " bytes");
+    }
+  }
+
+  struct v4l2_requestbuffers req;
+  CLEAR(req);
+  req.count = buffers.size();
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_USERPTR;
+  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_REQBUFS), &req)) {
+    throw std::runtime_error("Unable to request user pointer buffers");
+  }
+  if (req.count == 0) {
+    throw std::runtime_error("Device did not accept any user buffer");
+  }
+
+  if (!m_user_buffers) {
+    for (unsigned int i = 0; i < m_number_of_buffers; ++i) {
+      free(m_buffers[i].start);
     }
   }
+  free(m_buffers);
+
+  // The driver may accept fewer buffers than offered, the rest stay unused
+  const size_t number_of_buffers = std::min<size_t>(req.count, buffers.size());
+  m_buffers = reinterpret_cast<usb_cam::utils::buffer *>(
+    calloc(number_of_buffers, sizeof(*m_buffers)));
+  if (!m_buffers) {
+    throw std::overflow_error("Out of memory");
+  }
+  for (size_t i = 0; i < number_of_buffers; ++i) {
+    m_buffers[i].start = buffers[i].start;
+    m_buffers[i].length = buffers[i].length;
+    m_buffers[i].dmabuf_fd = -1;
+  }
+  m_number_of_buffers = number_of_buffers;
+  m_buffer_depth = number_of_buffers;
+  m_user_buffers = true;
 }
 
 void UsbCam::init_device()
@@ -470,26 +778,35 @@ void UsbCam::init_device()
   }
 
   m_image.v4l2_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  m_image.v4l2_fmt.fmt.pix.width = m_image.width;
-  m_image.v4l2_fmt.fmt.pix.height = m_image.height;
+  // Capture at the requested size, `m_image` holds the size of the published image
+  m_image.v4l2_fmt.fmt.pix.width = m_parameters.image_width;
+  m_image.v4l2_fmt.fmt.pix.height = m_parameters.image_height;
   m_image.v4l2_fmt.fmt.pix.pixelformat = m_image.pixel_format->v4l2();
   m_image.v4l2_fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
   // Set v4l2 capture format
   // Note VIDIOC_S_FMT may change width and height
   if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_S_FMT), &m_image.v4l2_fmt)) {
-    throw strerror(errno);
+    throw std::runtime_error(std::string("Unable to set the capture format: ") + strerror(errno));
   }
 
+  // Rather than querying the format for every frame, have the driver tell us when the
+  // source changes. Not all drivers support this, in which case the format is fixed.
+  struct v4l2_event_subscription subscription;
+  CLEAR(subscription);
+  subscription.type = V4L2_EVENT_SOURCE_CHANGE;
+  usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_SUBSCRIBE_EVENT), &subscription);
+
   struct v4l2_streamparm stream_params;
   memset(&stream_params, 0, sizeof(stream_params));
   stream_params.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   if (usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_G_PARM), &stream_params) < 0) {
-    throw strerror(errno);
+    throw std::runtime_error(
+            std::string("Unable to query the stream parameters: ") + strerror(errno));
   }
 
   if (!stream_params.parm.capture.capability && V4L2_CAP_TIMEPERFRAME) {
-    throw "V4L2_CAP_TIMEPERFRAME not supported";
+    throw std::runtime_error("V4L2_CAP_TIMEPERFRAME not supported");
   }
 
   // TODO(lucasw) need to get list of valid numerator/denominator pairs
@@ -500,6 +817,14 @@ void UsbCam::init_device()
     throw std::invalid_argument("Couldn't set camera framerate");
   }
 
+  // The driver reports the frame interval it actually uses, stalls are measured in those
+  const struct v4l2_fract & interval = stream_params.parm.capture.timeperframe;
+  if (interval.numerator > 0 && interval.denominator > 0) {
+    m_frame_period_us = static_cast<int64_t>(1000000) * interval.numerator / interval.denominator;
+  } else {
+    m_frame_period_us = 1000000 / std::max(m_parameters.framerate, 1);
+  }
+
   switch (m_io) {
     case io_method_t::IO_METHOD_READ:
       init_read();
@@ -518,8 +843,32 @@ void UsbCam::init_device()
 
 void UsbCam::close_device()
 {
-  if (-1 == close(m_fd)) {
-    throw strerror(errno);
+  if (m_epoll_fd != -1) {
+    close(m_epoll_fd);
+    m_epoll_fd = -1;
+  }
+  if (m_wakeup_fd != -1) {
+    close(m_wakeup_fd);
+    m_wakeup_fd = -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_released_mutex);
+    if (m_release_fd != -1) {
+      close(m_release_fd);
+      m_release_fd = -1;
+    }
+    m_released_buffers.clear();
+  }
+
+  m_device_watcher.reset();
+  m_lost_user_buffers.clear();
+  ++m_buffer_generation;
+  m_held_buffers.clear();
+
+  std::lock_guard<std::mutex> lock(m_controls_mutex);
+  m_controls.clear();
+  if (m_fd != -1 && -1 == close(m_fd)) {
+    throw std::runtime_error(std::string("Unable to close the device: ") + strerror(errno));
   }
 
   m_fd = -1;
@@ -530,18 +879,81 @@ void UsbCam::open_device()
   struct stat st;
 
   if (-1 == stat(m_parameters.device_name.c_str(), &st)) {
-    throw strerror(errno);
+    throw std::runtime_error(
+            "Unable to find " + m_parameters.device_name + ": " + strerror(errno));
   }
 
   if (!S_ISCHR(st.st_mode)) {
-    throw strerror(errno);
+    throw std::runtime_error(m_parameters.device_name + " is not a device");
   }
 
-  m_fd = open(m_parameters.device_name.c_str(), O_RDWR /* required */ | O_NONBLOCK, 0);
+  const int fd = open(m_parameters.device_name.c_str(), O_RDWR /* required */ | O_NONBLOCK, 0);
 
-  if (-1 == m_fd) {
-    throw strerror(errno);
+  if (-1 == fd) {
+    throw std::runtime_error(
+            "Unable to open " + m_parameters.device_name + ": " + strerror(errno));
+  }
+  {
+    // Controls may be set from another thread while reconnecting
+    std::lock_guard<std::mutex> lock(m_controls_mutex);
+    m_fd = fd;
   }
+
+  struct epoll_event event;
+  CLEAR(event);
+  // Frames are waited for with epoll on the device, together with an eventfd that
+  // `interrupt` uses to wake up the wait and one that `release_frame` uses. All of them
+  // outlive a lost device.
+  if (-1 == m_epoll_fd) {
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    {
+      std::lock_guard<std::mutex> lock(m_released_mutex);
+      m_release_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+    if (-1 == m_epoll_fd || -1 == m_wakeup_fd || -1 == m_release_fd) {
+      throw std::runtime_error(std::string("Unable to set up frame events: ") + strerror(errno));
+    }
+    event.events = EPOLLIN;
+    for (const int fd : {m_wakeup_fd, m_release_fd}) {
+      event.data.fd = fd;
+      if (-1 == epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        throw std::runtime_error(std::string("Unable to wait on device: ") + strerror(errno));
+      }
+    }
+  }
+
+  // EPOLLPRI signals pending V4L2 events, see `handle_events`
+  event.events = EPOLLIN | EPOLLPRI;
+  event.data.fd = m_fd;
+  if (-1 == epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_fd, &event)) {
+    throw std::runtime_error(std::string("Unable to wait on device: ") + strerror(errno));
+  }
+
+  // What the device reports about itself only changes with the device, its port or driver
+  m_supported_formats.clear();
+  m_capability_cache.reset();
+  struct v4l2_capability capability;
+  CLEAR(capability);
+  if (m_parameters.cache_capabilities &&
+    0 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QUERYCAP), &capability))
+  {
+    m_capability_cache.reset(
+      new CapabilityCache(CapabilityCache::default_directory(), capability));
+  }
+
+  // Resolve controls by name once, instead of on every change
+  std::lock_guard<std::mutex> lock(m_controls_mutex);
+  std::vector<struct v4l2_query_ext_ctrl> controls;
+  if (m_capability_cache && m_capability_cache->load_controls(controls)) {
+    m_controls.assign(controls);
+  } else {
+    m_controls.enumerate(m_fd);
+    if (m_capability_cache) {
+      m_capability_cache->save_controls(m_controls.list());
+    }
+  }
+  m_applied_controls.clear();
 }
 
 void UsbCam::configure()
@@ -556,21 +968,131 @@ void UsbCam::configure()
   }
   // Open device file descriptor before anything else
   open_device();
+  configure_format();
+}
 
+/// @brief Everything `configure` and `reconfigure` set up once the device is open: the
+/// capture format, the conversion and the buffers
+void UsbCam::configure_format()
+{
   m_image.width = static_cast<int>(m_parameters.image_width);
   m_image.height = static_cast<int>(m_parameters.image_height);
   m_image.set_number_of_pixels();
 
+  if (m_parameters.pixel_format_name == "auto") {
+    const format_choice_t choice = choose_pixel_format(
+      supported_formats(), m_parameters.image_width, m_parameters.image_height,
+      m_parameters.framerate);
+    std::cout << "Chose pixel format '" << choice.pixel_format_name << "': " <<
+      choice.reason << std::endl;
+    m_parameters.pixel_format_name = choice.pixel_format_name;
+  }
+
   // Do this before calling set_bytes_per_line and set_size_in_bytes
   m_image.pixel_format = set_pixel_format_from_string(m_parameters.pixel_format_name);
+
+  // The published image is smaller than the captured one when decoding at a reduced scale
+  const int scale = m_image.pixel_format->decode_scale();
+  if (scale > 1) {
+    m_image.width = (m_image.width + scale - 1) / scale;
+    m_image.height = (m_image.height + scale - 1) / scale;
+    m_image.set_number_of_pixels();
+  }
   m_image.set_bytes_per_line();
   m_image.set_size_in_bytes();
+  m_image.bytes_used = 0;
+
+  if (m_parameters.conversion_threads > 1 && m_image.pixel_format->is_band_splittable()) {
+    // Reconfiguring keeps the threads if there are as many
+    if (!m_conversion_pool ||
+      m_conversion_pool->size() != static_cast<size_t>(m_parameters.conversion_threads))
+    {
+      m_conversion_pool.reset(new ThreadPool(m_parameters.conversion_threads));
+    }
+  } else {
+    m_conversion_pool.reset();
+  }
+
+  // MJPEG frames are intra-only, so whole frames can be decoded in parallel by independent
+  // decoders. Needs the V4L2 sequence number, so only for the streaming IO methods.
+  m_decoder_pipeline.reset();
+  if (m_parameters.decoder_threads > 1 && m_io != io_method_t::IO_METHOD_READ &&
+    m_image.pixel_format->v4l2() == V4L2_PIX_FMT_MJPEG &&
+    m_image.pixel_format->requires_conversion())
+  {
+    std::vector<std::shared_ptr<pixel_format_base>> decoders{m_image.pixel_format};
+    for (int i = 1; i < m_parameters.decoder_threads; ++i) {
+      decoders.push_back(create_pixel_format(m_parameters.pixel_format_name));
+    }
+    m_decoder_pipeline.reset(new DecoderPipeline(decoders, m_image.size_in_bytes));
+  }
+
+  // Decides about every 2 seconds, between the 2 buffers needed to capture without gaps
+  // and `VIDEO_MAX_FRAME`
+  m_buffer_depth_policy.reset();
+  if (m_parameters.adaptive_buffer_count && m_io != io_method_t::IO_METHOD_READ) {
+    m_buffer_depth_policy.reset(
+      new BufferDepthPolicy(2, VIDEO_MAX_FRAME, 2 * std::max(m_parameters.framerate, 1)));
+  }
 
   // Allocate memory for the image
   m_image.data = reinterpret_cast<char *>(calloc(m_image.size_in_bytes, sizeof(char *)));
   memset(m_image.data, 0, m_image.size_in_bytes * sizeof(char *));
 
   init_device();
+
+  // Compressed frames are copied as captured, and the driver only reports how large they
+  // can get once the format is set
+  if (m_image.pixel_format->is_compressed() &&
+    m_image.v4l2_fmt.fmt.pix.sizeimage > m_image.size_in_bytes)
+  {
+    m_image.size_in_bytes = m_image.v4l2_fmt.fmt.pix.sizeimage;
+    free(m_image.data);
+    m_image.data = reinterpret_cast<char *>(calloc(m_image.size_in_bytes, sizeof(char *)));
+  }
+}
+
+void UsbCam::reconfigure(const parameters_t & parameters)
+{
+  if (parameters.device_name != m_parameters.device_name ||
+    parameters.io_method_name != m_parameters.io_method_name)
+  {
+    throw std::invalid_argument(
+            "Changing the device or IO method requires shutting down and configuring again");
+  }
+  if (m_device_watcher) {
+    throw std::runtime_error("Unable to reconfigure while the device is lost");
+  }
+
+  const bool was_capturing = m_is_capturing;
+  stop_capturing();
+  uninit_device();
+  // Buffers of the old format have to be freed by the driver before setting a new one
+  if (m_io != io_method_t::IO_METHOD_READ) {
+    struct v4l2_requestbuffers req;
+    CLEAR(req);
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = m_io == io_method_t::IO_METHOD_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+    if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_REQBUFS), &req)) {
+      throw std::runtime_error(std::string("Unable to free buffers: ") + strerror(errno));
+    }
+  }
+  m_buffers = NULL;
+  m_number_of_buffers = 0;
+  m_user_buffers = false;
+  m_parked_buffers.clear();
+  m_image.data = nullptr;
+
+  // A wake up meant for a capture that stopped before this must not end the next wait
+  uint64_t count;
+  while (read(m_wakeup_fd, &count, sizeof(count)) > 0) {}
+
+  m_parameters = parameters;
+  configure_format();
+  if (was_capturing) {
+    start_capturing();
+  }
 }
 
 void UsbCam::start()
@@ -583,6 +1105,8 @@ void UsbCam::shutdown()
   stop_capturing();
   uninit_device();
   close_device();
+  m_conversion_pool.reset();
+  m_decoder_pipeline.reset();
 
   m_image.data = nullptr;
 }
@@ -595,7 +1119,9 @@ char * UsbCam::get_image()
     return nullptr;
   }
   // grab the image
-  grab_image();
+  if (!grab_image()) {
+    return nullptr;
+  }
   return m_image.data;
 }
 
@@ -603,30 +1129,39 @@ char * UsbCam::get_image()
 /// @param destination destination to fill in with image
 /// Note: destination must be pre-allocated to the proper size (use 
 /// UsbCam::get_image_size() utility to get proper size)
-void UsbCam::get_image(char * destination)
+bool UsbCam::get_image(char * destination)
 {
   if ((m_image.width == 0) || (m_image.height == 0)) {
-    return;
+    return false;
   }
-  // Set the destination pointer to be filled
+  // Fill the destination instead, but only for this image: `m_image.data` stays the buffer
+  // `uninit_device` frees, also when reconfiguring
+  char * const image_data = m_image.data;
   m_image.data = destination;
-  // grab the image
-  grab_image();
+  bool grabbed;
+  try {
+    grabbed = grab_image();
+  } catch (...) {
+    m_image.data = image_data;
+    throw;
+  }
+  m_image.data = image_data;
+  return grabbed;
 }
 
 std::vector<capture_format_t> UsbCam::get_supported_formats()
 {
   m_supported_formats.clear();
   struct v4l2_fmtdesc current_format;
+  CLEAR(current_format);
   current_format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  current_format.index = 0;
   for (current_format.index = 0;
     usb_cam::utils::xioctl(
       m_fd, static_cast<int>(VIDIOC_ENUM_FMT), &current_format) == 0;
     ++current_format.index)
   {
     struct v4l2_frmsizeenum current_size;
-    current_size.index = 0;
+    CLEAR(current_size);
     current_size.pixel_format = current_format.pixelformat;
 
     for (current_size.index = 0;
@@ -634,145 +1169,514 @@ std::vector<capture_format_t> UsbCam::get_supported_formats()
         m_fd, static_cast<int>(VIDIOC_ENUM_FRAMESIZES), &current_size) == 0;
       ++current_size.index)
     {
-      struct v4l2_frmivalenum current_interval;
-      current_interval.index = 0;
-      current_interval.pixel_format = current_size.pixel_format;
-      current_interval.width = current_size.discrete.width;
-      current_interval.height = current_size.discrete.height;
-      for (current_interval.index = 0;
-        usb_cam::utils::xioctl(
-          m_fd, static_cast<int>(VIDIOC_ENUM_FRAMEINTERVALS), &current_interval) == 0;
-        ++current_interval.index)
-      {
-        if (current_interval.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+      // A range of sizes is reported once, list the intervals at its smallest and largest
+      std::vector<std::pair<uint32_t, uint32_t>> sizes;
+      if (current_size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+        sizes.emplace_back(current_size.discrete.width, current_size.discrete.height);
+      } else {
+        sizes.emplace_back(current_size.stepwise.min_width, current_size.stepwise.min_height);
+        sizes.emplace_back(current_size.stepwise.max_width, current_size.stepwise.max_height);
+      }
+
+      for (const auto & size : sizes) {
+        struct v4l2_frmivalenum current_interval;
+        CLEAR(current_interval);
+        current_interval.pixel_format = current_size.pixel_format;
+        current_interval.width = size.first;
+        current_interval.height = size.second;
+        for (current_interval.index = 0;
+          usb_cam::utils::xioctl(
+            m_fd, static_cast<int>(VIDIOC_ENUM_FRAMEINTERVALS), &current_interval) == 0;
+          ++current_interval.index)
+        {
           capture_format_t capture_format;
           capture_format.format = current_format;
           capture_format.v4l2_fmt = current_interval;
+          capture_format.size = current_size;
           m_supported_formats.push_back(capture_format);
-        }
-      }  // interval loop
+          // A range of intervals is reported once as well
+          if (current_interval.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+            break;
+          }
+        }  // interval loop
+      }
+
+      if (current_size.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+        break;
+      }
     }  // size loop
   }  // fmt loop
 
+  if (m_capability_cache) {
+    m_capability_cache->save_formats(m_supported_formats);
+  }
   return m_supported_formats;
 }
 
-void UsbCam::grab_image()
+/// @brief Wait for the driver to mark a frame ready and read it into `m_image.data`
+/// @return false if interrupted by `interrupt`
+bool UsbCam::grab_image()
 {
-  fd_set fds;
-  struct timeval tv;
-  int r;
+  // Frames can be dequeued without producing an image (e.g. while filling the decoder
+  // pipeline), so keep waiting until one comes out
+  while (wait_for_frame()) {
+    if (read_frame()) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  FD_ZERO(&fds);
-  FD_SET(m_fd, &fds);
+FrameHandle UsbCam::get_frame()
+{
+  if (m_io != io_method_t::IO_METHOD_MMAP && m_io != io_method_t::IO_METHOD_USERPTR) {
+    throw std::invalid_argument("Frame handles require the mmap or userptr IO method");
+  }
 
-  /* Timeout. */
-  tv.tv_sec = 5;
-  tv.tv_usec = 0;
+  struct v4l2_buffer buf;
+  while (wait_for_frame()) {
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = m_io == io_method_t::IO_METHOD_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+    if (!dequeue_buffer(buf)) {
+      continue;
+    }
+    if (m_parameters.latest_frame_only) {
+      dequeue_latest_buffer(buf);
+    }
+
+    if (buf.index >= m_number_of_buffers) {
+      throw std::runtime_error("Driver returned a buffer that was never queued");
+    }
+    const char * data = m_io == io_method_t::IO_METHOD_MMAP ?
+      m_buffers[buf.index].start : reinterpret_cast<const char *>(buf.m.userptr);
+    m_held_buffers.push_back(buf.index);
+    return FrameHandle(
+      this, m_buffer_generation, buf, data, m_image.v4l2_fmt.fmt.pix.bytesperline,
+      get_buffer_stamp(buf));
+  }
+  return FrameHandle();
+}
 
-  r = select(m_fd + 1, &fds, NULL, NULL, &tv);
+std::vector<int> UsbCam::export_dmabufs()
+{
+  if (m_io != io_method_t::IO_METHOD_MMAP) {
+    throw std::invalid_argument("Only driver allocated (mmap IO method) buffers can be exported");
+  }
 
-  if (-1 == r) {
-    if (EINTR == errno) {
-      // interruped (e.g. maybe Ctrl + c) so don't throw anything
-      return;
+  std::vector<int> dmabuf_fds;
+  for (unsigned int i = 0; i < m_number_of_buffers; ++i) {
+    if (m_buffers[i].dmabuf_fd == -1) {
+      struct v4l2_exportbuffer export_buffer;
+      CLEAR(export_buffer);
+      export_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      export_buffer.index = i;
+      export_buffer.flags = O_RDONLY | O_CLOEXEC;
+      if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_EXPBUF), &export_buffer)) {
+        throw std::runtime_error(
+                std::string("Unable to export buffer as DMABUF: ") + strerror(errno));
+      }
+      m_buffers[i].dmabuf_fd = export_buffer.fd;
     }
+    dmabuf_fds.push_back(m_buffers[i].dmabuf_fd);
+  }
+  return dmabuf_fds;
+}
+
+/// @brief Convert the monotonic timestamp of a dequeued buffer to wall time
+timespec UsbCam::get_buffer_stamp(const struct v4l2_buffer & buf)
+{
+  timespec stamp;
+  stamp.tv_sec = static_cast<time_t>(buf.timestamp.tv_sec) + m_epoch_time_shift;
+  stamp.tv_nsec = static_cast<int64_t>(buf.timestamp.tv_usec) * 1000;
+  return stamp;
+}
 
-    std::cerr << "Something went wrong, exiting..." << errno << std::endl;
-    throw errno;
+/// @brief Time from the capture of `buf` until now, 0 if the driver's timestamps are not
+/// taken from the monotonic clock
+int64_t UsbCam::get_buffer_lag_us(const struct v4l2_buffer & buf)
+{
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    return 0;
   }
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (static_cast<int64_t>(now.tv_sec) - buf.timestamp.tv_sec) * 1000000 +
+         (now.tv_nsec / 1000 - buf.timestamp.tv_usec);
+}
 
-  if (0 == r) {
-    std::cerr << "Select timeout, exiting..." << std::endl;
-    throw "select timeout";
+/// @brief Wait until the driver has a frame ready, handling device events and a lost device
+/// on the way
+/// @return false if interrupted by `interrupt`, or while the device is lost
+bool UsbCam::wait_for_frame()
+{
+  struct epoll_event events[2];
+  const int stall_timeout_ms = std::max(
+    static_cast<int>(std::max(m_parameters.stall_timeout_frames, 1) * m_frame_period_us / 1000),
+    MIN_STALL_TIMEOUT_MS);
+
+  while (true) {
+    requeue_released_buffers();
+    if (m_device_lost) {
+      lose_device();
+    }
+    if (m_device_watcher && !reconnect()) {
+      return false;
+    }
+
+    const int number_of_events = epoll_wait(m_epoll_fd, events, 2, stall_timeout_ms);
+
+    if (-1 == number_of_events) {
+      if (EINTR == errno) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Unable to wait for a frame: ") + strerror(errno));
+    }
+
+    if (0 == number_of_events) {
+      // Not every driver reports being unplugged while streaming
+      if (is_device_gone()) {
+        m_device_lost = true;
+        continue;
+      }
+      throw std::runtime_error(
+              "No frame from the device for " + std::to_string(stall_timeout_ms) + " ms");
+    }
+
+    bool frame_ready = false;
+    for (int i = 0; i < number_of_events; ++i) {
+      if (events[i].data.fd == m_wakeup_fd) {
+        uint64_t count;
+        if (-1 == read(m_wakeup_fd, &count, sizeof(count))) {
+          // Already reset by a concurrent wait, nothing to do
+        }
+        return false;
+      }
+      if (events[i].data.fd == m_release_fd) {
+        // Queued at the top of the loop
+        continue;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        if (is_device_gone()) {
+          m_device_lost = true;
+          break;
+        }
+        throw std::runtime_error("Device reported an error while waiting for a frame");
+      }
+      if (events[i].events & EPOLLPRI) {
+        handle_events();
+      }
+      frame_ready = frame_ready || (events[i].events & EPOLLIN);
+    }
+
+    if (frame_ready && !m_device_lost) {
+      return true;
+    }
   }
+}
 
-  read_frame();
+/// @brief True if the device was unplugged or reset on the bus, every ioctl then fails with
+/// `ENODEV`. The device node may already be back, but this file descriptor stays unusable.
+bool UsbCam::is_device_gone()
+{
+  struct v4l2_capability capability;
+  return -1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QUERYCAP), &capability) &&
+         ENODEV == errno;
 }
 
-// enables/disables auto focus
-bool UsbCam::set_auto_focus(int value)
+/// @brief Release everything tied to the lost device and watch for it to come back, see
+/// `reconnect`. Capturing stays on, it resumes once the device is back.
+void UsbCam::lose_device()
 {
-  struct v4l2_queryctrl queryctrl;
-  struct v4l2_ext_control control;
+  m_device_lost = false;
+  m_lost_at = std::chrono::steady_clock::now();
+  m_stats.record_disconnect();
+  std::cerr << "Lost " << m_parameters.device_name << ", waiting for it to come back" <<
+    std::endl;
+
+  // Watch before closing, so that the device coming back right away is not missed
+  m_device_watcher.reset(new DeviceWatcher(m_parameters.device_name));
+  if (m_device_watcher->fd() != -1) {
+    struct epoll_event event;
+    CLEAR(event);
+    event.events = EPOLLIN;
+    event.data.fd = m_device_watcher->fd();
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_device_watcher->fd(), &event);
+  }
 
-  memset(&queryctrl, 0, sizeof(queryctrl));
-  queryctrl.id = V4L2_CID_FOCUS_AUTO;
+  if (m_decoder_pipeline) {
+    m_decoder_pipeline->flush();
+  }
+  // Caller owned buffers are registered again once the device is back
+  m_lost_user_buffers.clear();
+  for (unsigned int i = 0; m_user_buffers && i < m_number_of_buffers; ++i) {
+    m_lost_user_buffers.push_back(m_buffers[i]);
+  }
+  release_device();
+}
 
-  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_QUERYCTRL), &queryctrl)) {
-    if (errno != EINVAL) {
-      std::cerr << "VIDIOC_QUERYCTRL" << std::endl;
-      return false;
-    } else {
-      std::cerr << "V4L2_CID_FOCUS_AUTO is not supported" << std::endl;
+/// @brief Free the buffers and close the device without any ioctl, for a device that may be
+/// gone. Closing the device also removes it from `m_epoll_fd`.
+void UsbCam::release_device()
+{
+  uninit_device();
+  m_buffers = NULL;
+  m_number_of_buffers = 0;
+  m_user_buffers = false;
+  m_parked_buffers.clear();
+  m_image.data = nullptr;
+
+  std::lock_guard<std::mutex> lock(m_controls_mutex);
+  if (m_fd != -1) {
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+/// @brief Wait up to `RECONNECT_INTERVAL_MS` for the lost device to come back, then open and
+/// configure it as before, set every control again and resume capturing
+/// @return true once the device is back, false if it is still missing or the wait was
+/// interrupted
+bool UsbCam::reconnect()
+{
+  struct epoll_event events[2];
+  const int number_of_events = epoll_wait(m_epoll_fd, events, 2, RECONNECT_INTERVAL_MS);
+  if (-1 == number_of_events && EINTR != errno) {
+    throw std::runtime_error(std::string("Unable to wait for the device: ") + strerror(errno));
+  }
+  for (int i = 0; i < number_of_events; ++i) {
+    if (events[i].data.fd == m_wakeup_fd) {
+      uint64_t count;
+      if (-1 == read(m_wakeup_fd, &count, sizeof(count))) {
+        // Already reset by a concurrent wait, nothing to do
+      }
       return false;
     }
-  } else if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
-    std::cerr << "V4L2_CID_FOCUS_AUTO is not supported" << std::endl;
+  }
+  // Events only say when to try right away, without any the device is tried every interval
+  // in case they were missed
+  if (!m_device_watcher->consume() && number_of_events > 0) {
     return false;
-  } else {
-    memset(&control, 0, sizeof(control));
-    control.id = V4L2_CID_FOCUS_AUTO;
-    control.value = value;
+  }
 
-    if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_S_CTRL), &control)) {
-      std::cerr << "VIDIOC_S_CTRL" << std::endl;
-      return false;
+  const bool capturing = m_is_capturing;
+  m_is_capturing = false;
+  try {
+    open_device();
+    configure_format();
+    if (!m_lost_user_buffers.empty()) {
+      register_user_buffers(m_lost_user_buffers);
+    }
+    if (capturing) {
+      start_capturing();
     }
+  } catch (...) {
+    // Not ready yet, e.g. udev didn't give it its permissions yet, or partly enumerated
+    release_device();
+    m_is_capturing = capturing;
+    return false;
   }
+
+  m_device_watcher.reset();
+  m_lost_user_buffers.clear();
+  // The device forgot every control, `open_device` forgot what was sent
+  set_v4l2_params(m_parameters);
+
+  const int64_t outage_us = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - m_lost_at).count();
+  m_stats.record_reconnect(outage_us);
+  std::cout << "Reopened " << m_parameters.device_name << " after " << outage_us / 1000 <<
+    " ms" << std::endl;
   return true;
 }
 
+/// @brief Dequeue pending V4L2 events. On a source change, query the format again and
+/// throw if it no longer matches the one the buffers were set up for.
+void UsbCam::handle_events()
+{
+  struct v4l2_event event;
+  bool source_changed = false;
+
+  CLEAR(event);
+  while (0 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_DQEVENT), &event)) {
+    if (event.type == V4L2_EVENT_SOURCE_CHANGE &&
+      (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION))
+    {
+      source_changed = true;
+    }
+  }
+
+  if (!source_changed) {
+    return;
+  }
+
+  struct v4l2_format format;
+  CLEAR(format);
+  format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (-1 == usb_cam::utils::xioctl(m_fd, static_cast<int>(VIDIOC_G_FMT), &format)) {
+    throw std::runtime_error("Unable to query the format after a source change");
+  }
+
+  if (format.fmt.pix.width != m_image.v4l2_fmt.fmt.pix.width ||
+    format.fmt.pix.height != m_image.v4l2_fmt.fmt.pix.height ||
+    format.fmt.pix.pixelformat != m_image.v4l2_fmt.fmt.pix.pixelformat ||
+    format.fmt.pix.sizeimage > m_image.v4l2_fmt.fmt.pix.sizeimage)
+  {
+    throw std::runtime_error(
+            "Device source changed to " + std::to_string(format.fmt.pix.width) + "x" +
+            std::to_string(format.fmt.pix.height) + ", the device must be configured again");
+  }
+  m_image.v4l2_fmt = format;
+}
+
+void UsbCam::interrupt()
+{
+  if (m_wakeup_fd == -1) {
+    return;
+  }
+  const uint64_t count = 1;
+  if (-1 == write(m_wakeup_fd, &count, sizeof(count))) {
+    // Only fails if the counter would overflow, i.e. a wake up is already pending
+  }
+}
+
+void UsbCam::set_v4l2_params(const parameters_t & parameters)
+{
+  std::vector<V4l2Controls::value_t> values;
+  // set camera parameters
+  if (parameters.brightness >= 0) {
+    values.emplace_back("brightness", parameters.brightness);
+  }
+  if (parameters.contrast >= 0) {
+    values.emplace_back("contrast", parameters.contrast);
+  }
+  if (parameters.saturation >= 0) {
+    values.emplace_back("saturation", parameters.saturation);
+  }
+  if (parameters.sharpness >= 0) {
+    values.emplace_back("sharpness", parameters.sharpness);
+  }
+  if (parameters.gain >= 0) {
+    values.emplace_back("gain", parameters.gain);
+  }
+
+  // check auto white balance
+  if (parameters.auto_white_balance) {
+    values.emplace_back("white_balance_temperature_auto", 1);
+  } else {
+    values.emplace_back("white_balance_temperature_auto", 0);
+    values.emplace_back("white_balance_temperature", parameters.white_balance);
+  }
+
+  // check auto exposure
+  if (!parameters.autoexposure) {
+    // turn down exposure control (from max of 3)
+    values.emplace_back("exposure_auto", 1);
+    // change the exposure level
+    values.emplace_back("exposure_absolute", parameters.exposure);
+  } else {
+    values.emplace_back("exposure_auto", 3);
+  }
+
+  // check auto focus
+  if (parameters.autofocus) {
+    values.emplace_back("focus_auto", 1);
+  } else {
+    values.emplace_back("focus_auto", 0);
+    if (parameters.focus >= 0) {
+      values.emplace_back("focus_absolute", parameters.focus);
+    }
+  }
+
+  // While in automatic mode the device changes the manual value itself, so it has to be
+  // sent again when switching back, even if the parameter didn't change
+  static const std::map<std::string, std::string> manual_controls = {
+    {"white_balance_temperature_auto", "white_balance_temperature"},
+    {"exposure_auto", "exposure_absolute"},
+    {"focus_auto", "focus_absolute"},
+  };
+
+  std::lock_guard<std::mutex> lock(m_controls_mutex);
+  std::vector<V4l2Controls::value_t> changed_values;
+  for (const auto & value : values) {
+    auto applied = m_applied_controls.find(value.first);
+    if (applied != m_applied_controls.end() && applied->second == value.second) {
+      continue;
+    }
+    std::cout << "Setting '" << value.first << "' to " << value.second << std::endl;
+    changed_values.push_back(value);
+    // Recorded even if setting it fails, so an unsupported control is only reported once
+    m_applied_controls[value.first] = value.second;
+    auto manual_control = manual_controls.find(value.first);
+    if (manual_control != manual_controls.end()) {
+      m_applied_controls.erase(manual_control->second);
+    }
+  }
+  if (!changed_values.empty()) {
+    set_controls(changed_values);
+  }
+}
+
+// enables/disables auto focus
+bool UsbCam::set_auto_focus(int value)
+{
+  return set_v4l_parameter("focus_auto", value);
+}
+
 /**
-* Set video device parameter via call to v4l-utils.
+* Set video device parameter via VIDIOC_S_EXT_CTRLS.
 *
 * @param param The name of the parameter to set
 * @param param The value to assign
 */
 bool UsbCam::set_v4l_parameter(const std::string & param, int value)
 {
-  char buf[33];
-  snprintf(buf, sizeof(buf), "%i", value);
-  return set_v4l_parameter(param, buf);
+  return set_v4l_parameters({{param, value}});
 }
 
 /**
-* Set video device parameter via call to v4l-utils.
+* Set video device parameter via VIDIOC_S_EXT_CTRLS.
 *
 * @param param The name of the parameter to set
-* @param param The value to assign
+* @param param The value to assign, an integer
 */
 bool UsbCam::set_v4l_parameter(const std::string & param, const std::string & value)
 {
-  int retcode = 0;
-  // build the command
-  std::stringstream ss;
-  ss << "v4l2-ctl --device=" << m_parameters.device_name;
-  ss << " -c " << param << "=" << value << " 2>&1";
-  std::string cmd = ss.str();
-
-  // capture the output
-  std::string output;
-  const int kBufferSize = 256;
-  char buffer[kBufferSize];
-  FILE * stream = popen(cmd.c_str(), "r");
-  if (stream) {
-    while (!feof(stream)) {
-      if (fgets(buffer, kBufferSize, stream) != NULL) {
-        output.append(buffer);
-      }
-    }
-    pclose(stream);
-    // any output should be an error
-    if (output.length() > 0) {
-      std::cerr << output.c_str() << std::endl;
-      retcode = 1;
+  char * end = nullptr;
+  errno = 0;
+  const int64_t number = strtoll(value.c_str(), &end, 0);
+  if (errno != 0 || end == value.c_str() || *end != '\0') {
+    std::cerr << "Unable to set control '" << param << "': '" << value <<
+      "' is not an integer" << std::endl;
+    return false;
+  }
+  return set_v4l_parameters({{param, number}});
+}
+
+bool UsbCam::set_v4l_parameters(const std::vector<V4l2Controls::value_t> & values)
+{
+  std::lock_guard<std::mutex> lock(m_controls_mutex);
+  return set_controls(values);
+}
+
+/// @brief `set_v4l_parameters` with `m_controls_mutex` already held
+bool UsbCam::set_controls(const std::vector<V4l2Controls::value_t> & values)
+{
+  const auto failed = m_controls.set(m_fd, values);
+  for (const auto & param : failed) {
+    std::cerr << "Unable to set control '" << param << "'";
+    if (m_controls.find(param) == nullptr) {
+      std::cerr << ": not supported by " << m_parameters.device_name;
     }
-  } else {
-    std::cerr << "usb_cam_node could not run '" << cmd.c_str() << "'" << std::endl;
-    retcode = 1;
+    std::cerr << std::endl;
   }
-  return retcode;
+  return failed.empty();
+}
+
+bool UsbCam::get_v4l_parameter(const std::string & param, int64_t & value)
+{
+  std::lock_guard<std::mutex> lock(m_controls_mutex);
+  return m_controls.get(m_fd, param, value);
 }
 
 }  // namespace usb_cam
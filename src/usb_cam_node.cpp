@@ -26,6 +26,7 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -42,9 +43,7 @@ UsbCamNode::UsbCamNode(const rclcpp::NodeOptions & node_options)
 : Node("usb_cam", node_options),
   m_camera(new usb_cam::UsbCam()),
   m_image_msg(new sensor_msgs::msg::Image()),
-  m_image_publisher(std::make_shared<image_transport::CameraPublisher>(
-      image_transport::create_camera_publisher(this, "image_raw",
-      rclcpp::QoS {100}.get_rmw_qos_profile()))),
+  m_compressed_img_msg(new sensor_msgs::msg::CompressedImage()),
   m_camera_info_msg(new sensor_msgs::msg::CameraInfo()),
   m_service_capture(
     this->create_service<std_srvs::srv::SetBool>(
@@ -77,6 +76,15 @@ UsbCamNode::UsbCamNode(const rclcpp::NodeOptions & node_options)
   this->declare_parameter("exposure", 100);
   this->declare_parameter("autofocus", false);
   this->declare_parameter("focus", -1);  // 0-255, -1 "leave alone"
+  this->declare_parameter("conversion_threads", 1);
+  this->declare_parameter("decoder_threads", 1);
+  this->declare_parameter("decode_scale", 1);
+  this->declare_parameter("frame_queue_size", 4);
+  this->declare_parameter("stall_timeout_frames", 30);
+  this->declare_parameter("latest_frame_only", false);
+  this->declare_parameter("buffer_count", 4);
+  this->declare_parameter("adaptive_buffer_count", false);
+  this->declare_parameter("cache_capabilities", true);
 
   get_ros_params();
   init();
@@ -89,6 +97,7 @@ UsbCamNode::UsbCamNode(const rclcpp::NodeOptions & node_options)
 UsbCamNode::~UsbCamNode()
 {
   RCLCPP_WARN(this->get_logger(), "Shutting down");
+  stop_threads();
   m_camera->shutdown();
 }
 
@@ -98,6 +107,7 @@ void UsbCamNode::service_capture(
   std::shared_ptr<std_srvs::srv::SetBool::Response> response)
 {
   (void) request_header;
+  std::lock_guard<std::mutex> lock(m_camera_mutex);
   if (request->data) {
     m_camera->start_capturing();
     response->message = "Start Capturing";
@@ -127,12 +137,17 @@ void UsbCamNode::init()
   if (!m_camera_info->isCalibrated()) {
     m_camera_info->setCameraName(m_camera->parameters().device_name);
     m_camera_info_msg->header.frame_id = m_camera->parameters().frame_id;
-    m_camera_info_msg->width = m_camera->get_image_width();
-    m_camera_info_msg->height = m_camera->get_image_height();
+    // The captured size, images decoded at a reduced scale are described by binning
+    m_camera_info_msg->width = m_camera->parameters().image_width;
+    m_camera_info_msg->height = m_camera->parameters().image_height;
     m_camera_info->setCameraInfo(*m_camera_info_msg);
   }
 
-  m_image_msg->header.frame_id = m_camera->parameters().frame_id;
+  init_publishers();
+  m_diagnostics_publisher = this->create_publisher<diagnostic_msgs::msg::DiagnosticArray>(
+    "diagnostics", rclcpp::QoS {10});
+  m_stats_timer = this->create_wall_timer(
+    std::chrono::seconds(1), std::bind(&UsbCamNode::publish_stats, this));
   RCLCPP_INFO(
     this->get_logger(), "Starting '%s' (%s) at %dx%d via %s (%s) at %i FPS",
     m_camera->parameters().camera_name.c_str(), m_camera->parameters().device_name.c_str(),
@@ -140,29 +155,325 @@ void UsbCamNode::init()
     m_camera->parameters().io_method_name.c_str(),
     m_camera->parameters().pixel_format_name.c_str(), m_camera->parameters().framerate);
 
+  // Served from the capability cache unless the device was never seen before
   RCLCPP_INFO(this->get_logger(), "This devices supproted formats:");
   for (auto fmt : m_camera->supported_formats()) {
-    RCLCPP_INFO(
-      this->get_logger(),
-      "\t%s: %d x %d (%d Hz)",
-      fmt.format.description,
-      fmt.v4l2_fmt.width,
-      fmt.v4l2_fmt.height,
-      fmt.v4l2_fmt.discrete.denominator / fmt.v4l2_fmt.discrete.numerator);
+    if (fmt.v4l2_fmt.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+      RCLCPP_INFO(
+        this->get_logger(),
+        "\t%s: %d x %d (%d Hz)",
+        fmt.format.description,
+        fmt.v4l2_fmt.width,
+        fmt.v4l2_fmt.height,
+        fmt.v4l2_fmt.discrete.denominator / fmt.v4l2_fmt.discrete.numerator);
+    } else {
+      // The shortest interval is the highest rate
+      RCLCPP_INFO(
+        this->get_logger(),
+        "\t%s: %d x %d (%d - %d Hz)",
+        fmt.format.description,
+        fmt.v4l2_fmt.width,
+        fmt.v4l2_fmt.height,
+        fmt.v4l2_fmt.stepwise.max.denominator / fmt.v4l2_fmt.stepwise.max.numerator,
+        fmt.v4l2_fmt.stepwise.min.denominator / fmt.v4l2_fmt.stepwise.min.numerator);
+    }
   }
 
   m_camera->set_v4l2_params();
 
+  init_frames();
+
   // start the camera
   m_camera->start();
+  RCLCPP_INFO(
+    this->get_logger(), "Capturing with %u driver buffers%s", m_camera->get_buffer_depth(),
+    m_camera->parameters().adaptive_buffer_count ? ", adapted to the load" : "");
+
+  start_threads();
+}
+
+/// @brief Creates the publishers the current pixel format needs, keeping those that exist
+void UsbCamNode::init_publishers()
+{
+  m_image_msg->header.frame_id = m_camera->parameters().frame_id;
+  m_compressed_img_msg->header.frame_id = m_camera->parameters().frame_id;
+  m_compressed_img_msg->format = m_camera->get_pixel_format()->ros();
+
+  if (m_camera->get_pixel_format()->is_compressed()) {
+    // The frames are already compressed, so publish them as captured on the topic the
+    // image_transport `compressed` plugin would use, without advertising a raw topic
+    if (!m_compressed_image_publisher) {
+      m_compressed_image_publisher = this->create_publisher<sensor_msgs::msg::CompressedImage>(
+        "image_raw/compressed", rclcpp::QoS {100});
+      m_compressed_cam_info_publisher = this->create_publisher<sensor_msgs::msg::CameraInfo>(
+        "camera_info", rclcpp::QoS {100});
+    }
+  } else if (!m_image_publisher) {
+    m_image_publisher = std::make_shared<image_transport::CameraPublisher>(
+      image_transport::create_camera_publisher(
+        this, "image_raw",
+        rclcpp::QoS {100}.get_rmw_qos_profile()));
+  }
+}
+
+/// @brief Sizes the frame pool for the configured image, the camera must not be capturing
+void UsbCamNode::init_frames()
+{
+  // Frames in flight: up to `frame_queue_size` waiting to be published, plus the one being
+  // captured and the one being published
+  const size_t number_of_frames = std::max(m_camera->parameters().frame_queue_size, 1) + 2;
+  m_frames.resize(number_of_frames);
+  m_free_frames.reset(new SpscRing<uint32_t>(number_of_frames));
+  m_captured_frames.reset(new SpscRing<uint32_t>(number_of_frames));
+  for (uint32_t i = 0; i < number_of_frames; ++i) {
+    m_frames[i].data.resize(m_camera->get_image_size());
+    m_free_frames->try_push(i);
+  }
 
-  // TODO(lucasw) should this check a little faster than expected frame rate?
-  // TODO(lucasw) how to do small than ms, or fractional ms- std::chrono::nanoseconds?
-  const int period_ms = 1000.0 / m_camera->parameters().framerate;
-  m_timer = this->create_wall_timer(
-    std::chrono::milliseconds(static_cast<int64_t>(period_ms)),
-    std::bind(&UsbCamNode::update, this));
-  RCLCPP_INFO_STREAM(this->get_logger(), "Timer triggering every " << period_ms << " ms");
+  // Images published as captured need no copy at all if the driver writes them straight into
+  // the frames, which then cycle between the driver and the publishing thread
+  m_zero_copy = false;
+  if (m_camera->get_io_method() == usb_cam::utils::IO_METHOD_USERPTR &&
+    !m_camera->get_pixel_format()->requires_conversion() &&
+    !m_camera->get_pixel_format()->is_compressed())
+  {
+    std::vector<usb_cam::utils::buffer> buffers;
+    for (auto & frame : m_frames) {
+      // The driver may fill padding past the image, keep it within the vector's capacity
+      frame.data.resize(m_camera->get_capture_buffer_size());
+      buffers.push_back({reinterpret_cast<char *>(frame.data.data()), frame.data.size(), -1});
+      frame.data.resize(m_camera->get_image_size());
+    }
+    try {
+      m_camera->set_user_buffers(buffers);
+      m_zero_copy = true;
+    } catch (const std::exception & e) {
+      RCLCPP_WARN(
+        this->get_logger(), "Unable to capture straight into published images: %s", e.what());
+    }
+  }
+}
+
+void UsbCamNode::start_threads()
+{
+  m_running = true;
+  if (m_zero_copy) {
+    m_capture_thread = std::thread(&UsbCamNode::capture_loop_zero_copy, this);
+  } else {
+    m_capture_thread = std::thread(&UsbCamNode::capture_loop, this);
+  }
+  m_publish_thread = std::thread(&UsbCamNode::publish_loop, this);
+}
+
+void UsbCamNode::stop_threads()
+{
+  m_running = false;
+  // Don't wait for the next frame, or for a stall to be detected, to stop capturing
+  m_camera->interrupt();
+  {
+    // Make sure the publishing thread is either waiting or sees `m_running`
+    std::lock_guard<std::mutex> lock(m_captured_mutex);
+  }
+  m_captured_cv.notify_one();
+  if (m_capture_thread.joinable()) {
+    m_capture_thread.join();
+  }
+  if (m_publish_thread.joinable()) {
+    m_publish_thread.join();
+  }
+  // Give the buffers of frames that were never published back to the driver
+  for (auto & frame : m_frames) {
+    frame.handle.release();
+  }
+}
+
+void UsbCamNode::capture_loop()
+{
+  const auto frame_period = std::chrono::microseconds(
+    static_cast<int64_t>(1e6 / std::max(m_camera->parameters().framerate, 1)));
+
+  while (m_running) {
+    uint32_t index;
+    if (!m_free_frames->try_pop(index)) {
+      // Publishing fell behind: rather than making the driver drop new frames, drop the
+      // oldest frame waiting to be published and capture into it
+      if (!m_captured_frames->drop_oldest(index)) {
+        // The publishing thread just took it, it is about to free another one
+        std::this_thread::yield();
+        continue;
+      }
+      m_camera->get_stats().record_publish_drop();
+      RCLCPP_WARN_THROTTLE(
+        this->get_logger(), *this->get_clock(), 5000,
+        "Publishing can't keep up with the camera, dropped %zu frames so far",
+        static_cast<size_t>(m_camera->get_stats().snapshot().publish_dropped_frames));
+    }
+
+    frame_t & frame = m_frames[index];
+    bool captured = false;
+    {
+      std::lock_guard<std::mutex> lock(m_camera_mutex);
+      apply_pending_parameters();
+      if (m_camera->is_capturing()) {
+        try {
+          captured = m_camera->get_image(reinterpret_cast<char *>(frame.data.data()));
+          frame.bytes_used = m_camera->get_image_bytes_used();
+          frame.stamp = m_camera->get_image_timestamp();
+          frame.dequeued = std::chrono::steady_clock::now();
+          get_frame_format(frame.format);
+        } catch (const std::exception & e) {
+          RCLCPP_ERROR_THROTTLE(
+            this->get_logger(), *this->get_clock(), 5000, "Unable to capture an image: %s",
+            e.what());
+        } catch (...) {
+          RCLCPP_ERROR_THROTTLE(
+            this->get_logger(), *this->get_clock(), 5000, "Unable to capture an image");
+        }
+      }
+    }
+
+    if (!captured) {
+      m_free_frames->try_push(index);
+      std::this_thread::sleep_for(frame_period);
+      continue;
+    }
+
+    m_captured_frames->try_push(index);
+    {
+      std::lock_guard<std::mutex> lock(m_captured_mutex);
+    }
+    m_captured_cv.notify_one();
+  }
+}
+
+void UsbCamNode::capture_loop_zero_copy()
+{
+  const auto frame_period = std::chrono::microseconds(
+    static_cast<int64_t>(1e6 / std::max(m_camera->parameters().framerate, 1)));
+  const size_t frame_queue_size = std::max(m_camera->parameters().frame_queue_size, 1);
+
+  frame_format_t format{};
+  while (m_running) {
+    FrameHandle handle;
+    {
+      std::lock_guard<std::mutex> lock(m_camera_mutex);
+      apply_pending_parameters();
+      if (m_camera->is_capturing()) {
+        try {
+          handle = m_camera->get_frame();
+          get_frame_format(format);
+        } catch (const std::exception & e) {
+          RCLCPP_ERROR_THROTTLE(
+            this->get_logger(), *this->get_clock(), 5000, "Unable to capture an image: %s",
+            e.what());
+        } catch (...) {
+          RCLCPP_ERROR_THROTTLE(
+            this->get_logger(), *this->get_clock(), 5000, "Unable to capture an image");
+        }
+      }
+    }
+
+    if (!handle) {
+      std::this_thread::sleep_for(frame_period);
+      continue;
+    }
+
+    // Frames waiting to be published hold their buffer away from the driver: when publishing
+    // falls behind, hand the oldest one back so that the driver never runs out of buffers
+    uint32_t dropped;
+    while (m_captured_frames->size() >= frame_queue_size &&
+      m_captured_frames->drop_oldest(dropped))
+    {
+      m_frames[dropped].handle.release();
+      m_camera->get_stats().record_publish_drop();
+      RCLCPP_WARN_THROTTLE(
+        this->get_logger(), *this->get_clock(), 5000,
+        "Publishing can't keep up with the camera, dropped %zu frames so far",
+        static_cast<size_t>(m_camera->get_stats().snapshot().publish_dropped_frames));
+    }
+
+    // The driver filled the frame's data in place, identified by the buffer index
+    const uint32_t index = handle.index();
+    frame_t & frame = m_frames[index];
+    frame.bytes_used = handle.bytes_used();
+    frame.stamp = handle.timestamp();
+    frame.dequeued = std::chrono::steady_clock::now();
+    frame.format = format;
+    frame.handle = std::move(handle);
+
+    m_captured_frames->try_push(index);
+    {
+      std::lock_guard<std::mutex> lock(m_captured_mutex);
+    }
+    m_captured_cv.notify_one();
+  }
+}
+
+/// @brief Capture thread only, with `m_camera_mutex` held
+void UsbCamNode::apply_pending_parameters()
+{
+  std::unique_ptr<parameters_t> parameters;
+  {
+    std::lock_guard<std::mutex> lock(m_pending_parameters_mutex);
+    parameters.swap(m_pending_parameters);
+  }
+  if (parameters) {
+    m_camera->assign_parameters(*parameters);
+  }
+}
+
+/// @brief Capture thread only, with `m_camera_mutex` held
+void UsbCamNode::get_frame_format(frame_format_t & format)
+{
+  format.compressed = m_camera->get_pixel_format()->is_compressed();
+  format.encoding = m_camera->get_pixel_format()->ros();
+  format.width = m_camera->get_image_width();
+  format.height = m_camera->get_image_height();
+  format.step = m_camera->get_image_step();
+  if (format.step == 0 && format.height > 0) {
+    // Some formats don't have a linesize specified by v4l2
+    // Fall back to manually calculating it step = size / height
+    format.step = m_camera->get_image_size() / format.height;
+  }
+  format.scale = m_camera->get_image_scale();
+}
+
+void UsbCamNode::publish_loop()
+{
+  // The stats outlive any reconnect, everything else about a frame comes with the frame
+  CaptureStats & stats = m_camera->get_stats();
+  while (true) {
+    uint32_t index;
+    {
+      // The lock only guards the wait, the ring itself is lock-free
+      std::unique_lock<std::mutex> lock(m_captured_mutex);
+      m_captured_cv.wait(
+        lock, [this]() {
+          return !m_running || !m_captured_frames->empty();
+        });
+    }
+    if (!m_running) {
+      return;
+    }
+    if (!m_captured_frames->try_pop(index)) {
+      // The capture thread dropped it in the meantime
+      continue;
+    }
+
+    if (m_frames[index].format.compressed) {
+      publish_image_mjpeg(m_frames[index]);
+    } else {
+      publish_image(m_frames[index]);
+    }
+    stats.record_publish(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_frames[index].dequeued).count());
+    if (m_zero_copy) {
+      m_frames[index].handle.release();
+    } else {
+      m_free_frames->try_push(index);
+    }
+  }
 }
 
 void UsbCamNode::get_ros_params()
@@ -173,16 +484,20 @@ void UsbCamNode::get_ros_params()
       "camera_name", "camera_info_url", "frame_id", "framerate", "image_height", "image_width",
       "io_method", "pixel_format", "video_device", "brightness", "contrast",
       "saturation", "sharpness", "gain", "auto_white_balance", "white_balance", "autoexposure",
-      "exposure", "autofocus", "focus"
+      "exposure", "autofocus", "focus", "conversion_threads",
+      "decoder_threads", "decode_scale", "frame_queue_size",
+      "stall_timeout_frames", "latest_frame_only", "buffer_count", "adaptive_buffer_count",
+      "cache_capabilities"
     }
   );
 
   assign_ros_params(m_ros_parameters);
+  m_camera->assign_parameters(m_parameters);
 }
 
 void UsbCamNode::assign_ros_params(const std::vector<rclcpp::Parameter> & parameters)
 {
-  usb_cam::parameters_t new_parameters{m_camera->parameters()};
+  usb_cam::parameters_t new_parameters{m_parameters};
   for (auto & parameter : parameters) {
     if (parameter.get_name() == "camera_name") {
       RCLCPP_INFO(this->get_logger(), "camera_name value: %s", parameter.value_to_string().c_str());
@@ -226,41 +541,117 @@ void UsbCamNode::assign_ros_params(const std::vector<rclcpp::Parameter> & parame
       new_parameters.autofocus = parameter.as_bool();
     } else if (parameter.get_name() == "focus") {
       new_parameters.focus = parameter.as_int();
+    } else if (parameter.get_name() == "conversion_threads") {
+      new_parameters.conversion_threads = parameter.as_int();
+    } else if (parameter.get_name() == "decoder_threads") {
+      new_parameters.decoder_threads = parameter.as_int();
+    } else if (parameter.get_name() == "decode_scale") {
+      new_parameters.decode_scale = parameter.as_int();
+    } else if (parameter.get_name() == "frame_queue_size") {
+      new_parameters.frame_queue_size = parameter.as_int();
+    } else if (parameter.get_name() == "stall_timeout_frames") {
+      new_parameters.stall_timeout_frames = parameter.as_int();
+    } else if (parameter.get_name() == "latest_frame_only") {
+      new_parameters.latest_frame_only = parameter.as_bool();
+    } else if (parameter.get_name() == "buffer_count") {
+      new_parameters.buffer_count = parameter.as_int();
+    } else if (parameter.get_name() == "adaptive_buffer_count") {
+      new_parameters.adaptive_buffer_count = parameter.as_bool();
+    } else if (parameter.get_name() == "cache_capabilities") {
+      new_parameters.cache_capabilities = parameter.as_bool();
     } else {
       RCLCPP_WARN(this->get_logger(), "Invalid parameter name: %s", parameter.get_name().c_str());
     }
   }
 
-  m_camera->assign_parameters(new_parameters);
+  m_parameters = new_parameters;
 }
 
-bool UsbCamNode::take_and_send_image()
+void UsbCamNode::publish_stats()
 {
-  // Only resize if required
-  if (m_image_msg->data.size() != m_camera->get_image_size()) {
-    m_image_msg->width = m_camera->get_image_width();
-    m_image_msg->height = m_camera->get_image_height();
-    m_image_msg->encoding = m_camera->get_pixel_format()->ros();
-    m_image_msg->step = m_camera->get_image_step();
-    if (m_image_msg->step == 0) {
-      // Some formats don't have a linesize specified by v4l2
-      // Fall back to manually calculating it step = size / height
-      m_image_msg->step = m_camera->get_image_size() / m_image_msg->height;
-    }
-    m_image_msg->data.resize(m_camera->get_image_size());
+  const capture_stats_t stats = m_camera->get_stats().snapshot();
+
+  diagnostic_msgs::msg::DiagnosticStatus status;
+  status.name = this->get_name() + std::string(": capture");
+  status.hardware_id = m_parameters.device_name;
+  // Only warn while frames are being lost, not forever after, and report a lost device for
+  // as long as it is gone
+  if (stats.disconnected) {
+    status.level = diagnostic_msgs::msg::DiagnosticStatus::ERROR;
+    status.message = "Device lost, waiting for it to come back";
+  } else if (stats.driver_dropped_frames != m_last_stats.driver_dropped_frames ||
+    stats.error_frames != m_last_stats.error_frames ||
+    stats.corrupt_frames != m_last_stats.corrupt_frames ||
+    stats.publish_dropped_frames != m_last_stats.publish_dropped_frames)
+  {
+    status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+    status.message = "Frames lost";
+  } else {
+    status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+    status.message = "OK";
   }
+  auto add_value = [&status](const std::string & key, const auto & value) {
+      diagnostic_msgs::msg::KeyValue key_value;
+      key_value.key = key;
+      key_value.value = std::to_string(value);
+      status.values.push_back(key_value);
+    };
+  add_value("frames", stats.frames);
+  add_value("driver_dropped_frames", stats.driver_dropped_frames);
+  add_value("skipped_frames", stats.skipped_frames);
+  add_value("publish_dropped_frames", stats.publish_dropped_frames);
+  add_value("error_frames", stats.error_frames);
+  add_value("corrupt_frames", stats.corrupt_frames);
+  add_value("last_dequeue_lag_us", stats.last_dequeue_lag_us);
+  add_value("max_dequeue_lag_us", stats.max_dequeue_lag_us);
+  add_value("last_publish_lag_us", stats.last_publish_lag_us);
+  add_value("max_publish_lag_us", stats.max_publish_lag_us);
+  add_value("buffer_depth", m_camera->get_buffer_depth());
+  add_value("disconnects", stats.disconnects);
+  add_value("last_outage_us", stats.last_outage_us);
+  m_last_stats = stats;
+
+  diagnostic_msgs::msg::DiagnosticArray diagnostics;
+  diagnostics.header.stamp = this->now();
+  diagnostics.status.push_back(status);
+  m_diagnostics_publisher->publish(diagnostics);
+}
 
-  // grab the image, pass image msg buffer to fill
-  m_camera->get_image(reinterpret_cast<char *>(&m_image_msg->data[0]));
+void UsbCamNode::publish_image(frame_t & frame)
+{
+  m_image_msg->width = frame.format.width;
+  m_image_msg->height = frame.format.height;
+  m_image_msg->encoding = frame.format.encoding;
+  m_image_msg->step = frame.format.step;
 
-  auto stamp = m_camera->get_image_timestamp();
-  m_image_msg->header.stamp.sec = stamp.tv_sec;
-  m_image_msg->header.stamp.nanosec = stamp.tv_nsec;
+  // Lend the frame's buffer to the message instead of copying it
+  m_image_msg->data.swap(frame.data);
+  m_image_msg->header.stamp.sec = frame.stamp.tv_sec;
+  m_image_msg->header.stamp.nanosec = frame.stamp.tv_nsec;
 
   *m_camera_info_msg = m_camera_info->getCameraInfo();
   m_camera_info_msg->header = m_image_msg->header;
+  // Keep the full resolution calibration and describe the reduced decode as binning
+  const int scale = frame.format.scale;
+  if (scale > 1) {
+    m_camera_info_msg->binning_x = std::max<uint32_t>(m_camera_info_msg->binning_x, 1) * scale;
+    m_camera_info_msg->binning_y = std::max<uint32_t>(m_camera_info_msg->binning_y, 1) * scale;
+  }
   m_image_publisher->publish(*m_image_msg, *m_camera_info_msg);
-  return true;
+  m_image_msg->data.swap(frame.data);
+}
+
+void UsbCamNode::publish_image_mjpeg(frame_t & frame)
+{
+  // Only `bytes_used` of the frame hold the compressed image
+  m_compressed_img_msg->data.assign(frame.data.begin(), frame.data.begin() + frame.bytes_used);
+  m_compressed_img_msg->header.stamp.sec = frame.stamp.tv_sec;
+  m_compressed_img_msg->header.stamp.nanosec = frame.stamp.tv_nsec;
+
+  *m_camera_info_msg = m_camera_info->getCameraInfo();
+  m_camera_info_msg->header = m_compressed_img_msg->header;
+  m_compressed_image_publisher->publish(*m_compressed_img_msg);
+  m_compressed_cam_info_publisher->publish(*m_camera_info_msg);
 }
 
 rcl_interfaces::msg::SetParametersResult UsbCamNode::parameters_callback(
@@ -268,29 +659,122 @@ rcl_interfaces::msg::SetParametersResult UsbCamNode::parameters_callback(
 {
   RCLCPP_DEBUG(
     this->get_logger(),
-    "Setting parameters for %s", m_camera->parameters().camera_name.c_str());
-  m_timer->reset();
+    "Setting parameters for %s", m_parameters.camera_name.c_str());
+  const parameters_t previous_parameters{m_parameters};
   assign_ros_params(parameters);
-  m_camera->set_v4l2_params();
+
   rcl_interfaces::msg::SetParametersResult result;
   result.successful = true;
   result.reason = "success";
+  if (m_parameters.device_name != previous_parameters.device_name ||
+    m_parameters.io_method_name != previous_parameters.io_method_name)
+  {
+    m_parameters = previous_parameters;
+    result.successful = false;
+    result.reason = "video_device and io_method can only be set when starting the node";
+    return result;
+  }
+
+  if (m_parameters.image_width != previous_parameters.image_width ||
+    m_parameters.image_height != previous_parameters.image_height ||
+    m_parameters.pixel_format_name != previous_parameters.pixel_format_name ||
+    m_parameters.framerate != previous_parameters.framerate ||
+    m_parameters.decode_scale != previous_parameters.decode_scale ||
+    m_parameters.conversion_threads != previous_parameters.conversion_threads ||
+    m_parameters.decoder_threads != previous_parameters.decoder_threads ||
+    m_parameters.buffer_count != previous_parameters.buffer_count ||
+    m_parameters.adaptive_buffer_count != previous_parameters.adaptive_buffer_count ||
+    m_parameters.frame_queue_size != previous_parameters.frame_queue_size)
+  {
+    std::string error;
+    if (!reconfigure(previous_parameters, error)) {
+      result.successful = false;
+      result.reason = error;
+      return result;
+    }
+  }
+
+  // Without waiting for the capture thread: only the controls that changed are sent to the
+  // device right away, and the capture thread picks up the new parameters between frames
+  m_camera->set_v4l2_params(m_parameters);
+  {
+    std::lock_guard<std::mutex> lock(m_pending_parameters_mutex);
+    m_pending_parameters.reset(new parameters_t(m_parameters));
+  }
   return result;
 }
 
-void UsbCamNode::update()
+/// @brief Switches the camera to `m_parameters` keeping the device open and the publishers
+/// advertised, only the capture and publishing threads are restarted. If the camera rejects
+/// them, `m_parameters` and the camera go back to `previous_parameters`.
+/// @return false with the reason in `error` if the camera rejected the parameters
+bool UsbCamNode::reconfigure(const parameters_t & previous_parameters, std::string & error)
 {
-  if (m_camera->is_capturing()) {
-    // If the camera exposure longer higher than the framerate period
-    // then that caps the framerate.
-    // auto t0 = now();
-    if (!take_and_send_image()) {
-      RCLCPP_WARN_ONCE(this->get_logger(), "USB camera did not respond in time.");
+  const auto start = std::chrono::steady_clock::now();
+  error.clear();
+  stop_threads();
+  {
+    std::lock_guard<std::mutex> lock(m_camera_mutex);
+    {
+      // Older than the parameters applied here
+      std::lock_guard<std::mutex> pending_lock(m_pending_parameters_mutex);
+      m_pending_parameters.reset();
+    }
+    // Capturing is resumed here, once the frames for the new size are registered, and also
+    // after going back to the previous parameters
+    const bool was_capturing = m_camera->is_capturing();
+    try {
+      m_camera->stop_capturing();
+      m_camera->reconfigure(m_parameters);
+    } catch (const std::exception & e) {
+      error = e.what();
+    } catch (...) {
+      error = "unknown error";
+    }
+    if (!error.empty()) {
+      RCLCPP_ERROR(this->get_logger(), "Unable to reconfigure the camera: %s", error.c_str());
+      m_parameters = previous_parameters;
+      try {
+        m_camera->reconfigure(m_parameters);
+      } catch (const std::exception & e) {
+        RCLCPP_ERROR(this->get_logger(), "Unable to restore the camera: %s", e.what());
+      } catch (...) {
+        RCLCPP_ERROR(this->get_logger(), "Unable to restore the camera");
+      }
+    }
+
+    if (!m_camera_info->isCalibrated()) {
+      m_camera_info_msg->width = m_camera->parameters().image_width;
+      m_camera_info_msg->height = m_camera->parameters().image_height;
+      m_camera_info->setCameraInfo(*m_camera_info_msg);
     }
-    // auto diff = now() - t0;
-    // INFO(diff.nanoseconds() / 1e6 << " " << int(t0.nanoseconds() / 1e9));
+    init_publishers();
+    init_frames();
+    if (was_capturing) {
+      try {
+        m_camera->start_capturing();
+      } catch (const std::exception & e) {
+        RCLCPP_ERROR(this->get_logger(), "Unable to resume capturing: %s", e.what());
+      } catch (...) {
+        RCLCPP_ERROR(this->get_logger(), "Unable to resume capturing");
+      }
+    }
+  }
+  start_threads();
+
+  if (!error.empty()) {
+    return false;
   }
+  RCLCPP_INFO(
+    this->get_logger(), "Switched to %dx%d via %s at %i FPS in %d ms",
+    m_camera->parameters().image_width, m_camera->parameters().image_height,
+    m_camera->parameters().pixel_format_name.c_str(), m_camera->parameters().framerate,
+    static_cast<int>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count()));
+  return true;
 }
+
 }  // namespace usb_cam
 
 
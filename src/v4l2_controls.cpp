@@ -0,0 +1,223 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "usb_cam/utils.hpp"
+#include "usb_cam/v4l2_controls.hpp"
+
+
+namespace usb_cam
+{
+
+namespace
+{
+
+/// @brief Names of controls renamed by newer kernels
+const std::map<std::string, uint32_t> LEGACY_NAMES = {
+  {"white_balance_temperature_auto", V4L2_CID_AUTO_WHITE_BALANCE},
+  {"exposure_auto", V4L2_CID_EXPOSURE_AUTO},
+  {"exposure_absolute", V4L2_CID_EXPOSURE_ABSOLUTE},
+  {"exposure_auto_priority", V4L2_CID_EXPOSURE_AUTO_PRIORITY},
+  {"focus_auto", V4L2_CID_FOCUS_AUTO},
+};
+
+void fill(
+  struct v4l2_ext_control & ext_control, const struct v4l2_query_ext_ctrl & control,
+  int64_t value)
+{
+  memset(&ext_control, 0, sizeof(ext_control));
+  ext_control.id = control.id;
+  if (control.type == V4L2_CTRL_TYPE_INTEGER64) {
+    ext_control.value64 = value;
+  } else {
+    ext_control.value = static_cast<int32_t>(value);
+  }
+}
+
+}  // namespace
+
+void V4l2Controls::enumerate(int fd)
+{
+  std::vector<struct v4l2_query_ext_ctrl> controls;
+  struct v4l2_query_ext_ctrl control;
+  memset(&control, 0, sizeof(control));
+  control.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+  while (0 == usb_cam::utils::xioctl(fd, static_cast<int>(VIDIOC_QUERY_EXT_CTRL), &control)) {
+    // Class controls only title the controls that follow them
+    if (control.type != V4L2_CTRL_TYPE_CTRL_CLASS &&
+      !(control.flags & V4L2_CTRL_FLAG_DISABLED))
+    {
+      controls.push_back(control);
+    }
+    control.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+  }
+  assign(controls);
+}
+
+void V4l2Controls::assign(const std::vector<struct v4l2_query_ext_ctrl> & controls)
+{
+  clear();
+  for (const auto & control : controls) {
+    const std::string name = normalize_name(control.name);
+    m_controls[name] = control;
+    m_names[control.id] = name;
+  }
+}
+
+std::vector<struct v4l2_query_ext_ctrl> V4l2Controls::list() const
+{
+  std::vector<struct v4l2_query_ext_ctrl> controls;
+  for (const auto & control : m_controls) {
+    controls.push_back(control.second);
+  }
+  return controls;
+}
+
+void V4l2Controls::clear()
+{
+  m_controls.clear();
+  m_names.clear();
+}
+
+const struct v4l2_query_ext_ctrl * V4l2Controls::find(const std::string & name) const
+{
+  auto control = m_controls.find(name);
+  if (control != m_controls.end()) {
+    return &control->second;
+  }
+  auto legacy_name = LEGACY_NAMES.find(name);
+  if (legacy_name != LEGACY_NAMES.end()) {
+    auto current_name = m_names.find(legacy_name->second);
+    if (current_name != m_names.end()) {
+      return &m_controls.at(current_name->second);
+    }
+  }
+  return nullptr;
+}
+
+std::vector<std::string> V4l2Controls::set(int fd, const std::vector<value_t> & values) const
+{
+  std::vector<std::string> failed;
+  std::vector<const struct v4l2_query_ext_ctrl *> controls;
+  std::vector<struct v4l2_ext_control> ext_controls;
+  std::vector<int64_t> batch_values;
+  for (const auto & value : values) {
+    const struct v4l2_query_ext_ctrl * control = find(value.first);
+    if (control == nullptr) {
+      failed.push_back(value.first);
+      continue;
+    }
+    struct v4l2_ext_control ext_control;
+    fill(ext_control, *control, value.second);
+    controls.push_back(control);
+    ext_controls.push_back(ext_control);
+    batch_values.push_back(value.second);
+  }
+  if (ext_controls.empty()) {
+    return failed;
+  }
+
+  struct v4l2_ext_controls batch;
+  memset(&batch, 0, sizeof(batch));
+  // Unlike a control class, the current value allows controls of any class in one batch
+  batch.which = V4L2_CTRL_WHICH_CUR_VAL;
+  batch.count = ext_controls.size();
+  batch.controls = ext_controls.data();
+  if (0 == usb_cam::utils::xioctl(fd, static_cast<int>(VIDIOC_S_EXT_CTRLS), &batch)) {
+    return failed;
+  }
+
+  for (size_t i = 0; i < controls.size(); ++i) {
+    if (!set_one(fd, *controls[i], batch_values[i])) {
+      failed.push_back(m_names.at(controls[i]->id));
+    }
+  }
+  return failed;
+}
+
+bool V4l2Controls::set_one(
+  int fd, const struct v4l2_query_ext_ctrl & control, int64_t value) const
+{
+  struct v4l2_ext_control ext_control;
+  fill(ext_control, control, value);
+
+  struct v4l2_ext_controls batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.which = V4L2_CTRL_WHICH_CUR_VAL;
+  batch.count = 1;
+  batch.controls = &ext_control;
+  return 0 == usb_cam::utils::xioctl(fd, static_cast<int>(VIDIOC_S_EXT_CTRLS), &batch);
+}
+
+bool V4l2Controls::get(int fd, const std::string & name, int64_t & value) const
+{
+  const struct v4l2_query_ext_ctrl * control = find(name);
+  if (control == nullptr) {
+    return false;
+  }
+
+  struct v4l2_ext_control ext_control;
+  fill(ext_control, *control, 0);
+
+  struct v4l2_ext_controls batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.which = V4L2_CTRL_WHICH_CUR_VAL;
+  batch.count = 1;
+  batch.controls = &ext_control;
+  if (-1 == usb_cam::utils::xioctl(fd, static_cast<int>(VIDIOC_G_EXT_CTRLS), &batch)) {
+    return false;
+  }
+  value = control->type == V4L2_CTRL_TYPE_INTEGER64 ? ext_control.value64 : ext_control.value;
+  return true;
+}
+
+std::string V4l2Controls::normalize_name(const char * name)
+{
+  std::string normalized;
+  bool separate = false;
+  for (; *name; ++name) {
+    const unsigned char character = static_cast<unsigned char>(*name);
+    if (std::isalnum(character)) {
+      if (separate) {
+        normalized += '_';
+      }
+      separate = false;
+      normalized += static_cast<char>(std::tolower(character));
+    } else if (!normalized.empty()) {
+      separate = true;
+    }
+  }
+  return normalized;
+}
+
+}  // namespace usb_cam
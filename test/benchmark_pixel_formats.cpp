@@ -0,0 +1,180 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+/// @file Micro-benchmarks for the pixel format conversion helpers.
+///
+/// Not part of the unit tests since the numbers depend on the machine. Build the
+/// package with optimizations enabled and run:
+///
+///   ./build/usb_cam/benchmark_pixel_formats
+///
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "usb_cam/formats/simd.hpp"
+#include "usb_cam/formats/utils.hpp"
+
+
+namespace
+{
+
+/// @brief Previous table based implementation of `CLIPVALUE`, kept to compare against
+const std::vector<unsigned char> legacy_clipping_table = []() {
+    std::vector<unsigned char> table;
+    for (int val = -128; val <= 383; val++) {
+      table.push_back(static_cast<unsigned char>(val < 0 ? 0 : (val > 255 ? 255 : val)));
+    }
+    return table;
+  }();
+
+unsigned char legacy_clip_value(const int & val)
+{
+  try {
+    return legacy_clipping_table.at(val + 128);
+  } catch (std::out_of_range const &) {
+    unsigned char clipped_val = val < 0 ? 0 : static_cast<unsigned char>(val);
+    return val > 255 ? 255 : clipped_val;
+  }
+}
+
+/// @brief `YUV2RGB` as it was with the table based clip
+void legacy_yuv2rgb(
+  const unsigned char & y, const unsigned char & u, const unsigned char & v,
+  unsigned char * r, unsigned char * g, unsigned char * b)
+{
+  const int y2 = static_cast<int>(y);
+  const int u2 = static_cast<int>(u - 128);
+  const int v2 = static_cast<int>(v - 128);
+  *r = legacy_clip_value(y2 + ((v2 * 37221) >> 15));
+  *g = legacy_clip_value(y2 - (((u2 * 12975) + (v2 * 18949)) >> 15));
+  *b = legacy_clip_value(y2 + ((u2 * 66883) >> 15));
+}
+
+/// @brief Previous scalar YUYV to RGB8 loop
+void legacy_yuyv2rgb(const unsigned char * src, unsigned char * dest, const int & number_of_pixels)
+{
+  unsigned char r, g, b;
+  for (int i = 0, j = 0; i < (number_of_pixels << 1); i += 4, j += 6) {
+    legacy_yuv2rgb(src[i + 0], src[i + 1], src[i + 3], &r, &g, &b);
+    dest[j + 0] = r;
+    dest[j + 1] = g;
+    dest[j + 2] = b;
+    legacy_yuv2rgb(src[i + 2], src[i + 1], src[i + 3], &r, &g, &b);
+    dest[j + 3] = r;
+    dest[j + 4] = g;
+    dest[j + 5] = b;
+  }
+}
+
+/// @brief Run `function` `iterations` times and return the mean time in milliseconds
+double time_ms(const std::function<void()> & function, const int & iterations)
+{
+  function();  // warm up caches
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    function();
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+void report(const char * name, const double & ms, const double & baseline_ms)
+{
+  printf("  %-28s %9.3f ms  (%5.1fx)\n", name, ms, baseline_ms / ms);
+}
+
+}  // namespace
+
+
+int main()
+{
+  const int iterations = 20;
+
+  // Stay within the range covered by the old table, where it never throws, and small
+  // enough to be cache resident so we measure the clip rather than memory bandwidth
+  std::vector<int> values(1 << 14);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = static_cast<int>((i * 2654435761u) % 512) - 128;
+  }
+  std::vector<unsigned char> clipped(values.size());
+  // Captured by value so the unsigned char stores can't alias the loop bounds
+  const int * in = values.data();
+  unsigned char * out = clipped.data();
+  const size_t count = values.size();
+
+  const int clip_iterations = 2000;
+  printf("CLIPVALUE over %zu values:\n", count);
+  const double legacy_clip_ms = time_ms(
+    [in, out, count]() {
+      for (size_t i = 0; i < count; i++) {
+        out[i] = legacy_clip_value(in[i]);
+      }
+    }, clip_iterations);
+  report("table + at() (previous)", legacy_clip_ms, legacy_clip_ms);
+  report(
+    "integer saturation", time_ms(
+      [in, out, count]() {
+        for (size_t i = 0; i < count; i++) {
+          out[i] = usb_cam::formats::CLIPVALUE(in[i]);
+        }
+      }, clip_iterations), legacy_clip_ms);
+
+  // A 1280x720 frame of natural looking data, chroma mostly near neutral
+  const int number_of_pixels = 1280 * 720;
+  std::vector<unsigned char> yuyv(number_of_pixels * 2);
+  for (size_t i = 0; i < yuyv.size(); i++) {
+    yuyv[i] = static_cast<unsigned char>(
+      (i % 2 == 0) ? (i / 2) % 256 : 128 + static_cast<int>((i * 37) % 96) - 48);
+  }
+  std::vector<unsigned char> rgb(number_of_pixels * 3);
+
+  printf("YUYV to RGB8, 1280x720:\n");
+  const double legacy_yuyv_ms = time_ms(
+    [&]() {legacy_yuyv2rgb(yuyv.data(), rgb.data(), number_of_pixels);}, iterations);
+  report("scalar, table clip (previous)", legacy_yuyv_ms, legacy_yuyv_ms);
+
+  const char * level_names[] = {"scalar", "SSE4.1", "AVX2"};
+  for (int level = usb_cam::formats::SIMD_LEVEL_SCALAR;
+    level <= usb_cam::formats::get_simd_level(); level++)
+  {
+    report(
+      level_names[level], time_ms(
+        [&]() {
+          usb_cam::formats::yuv422_to_rgb<usb_cam::formats::yuyv_order>(
+            yuyv.data(), rgb.data(), number_of_pixels,
+            static_cast<usb_cam::formats::simd_level_t>(level));
+        }, iterations), legacy_yuyv_ms);
+  }
+
+  return 0;
+}
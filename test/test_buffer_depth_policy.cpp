@@ -0,0 +1,89 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "usb_cam/buffer_depth_policy.hpp"
+
+
+TEST(test_buffer_depth_policy, grows_when_frames_are_skipped) {
+  usb_cam::BufferDepthPolicy policy(2, 8, 4);
+  const int64_t period_us = 33333;
+  unsigned int depth = 4;
+  // Decisions are only taken once per window
+  EXPECT_EQ(policy.update(depth, 0, 0, period_us), 4U);
+  EXPECT_EQ(policy.update(depth, 1, 0, period_us), 4U);
+  EXPECT_EQ(policy.update(depth, 3, 0, period_us), 4U);
+  depth = policy.update(depth, 4, 0, period_us);
+  EXPECT_EQ(depth, 5U);
+}
+
+TEST(test_buffer_depth_policy, shrinks_towards_needed_depth) {
+  usb_cam::BufferDepthPolicy policy(2, 8, 2);
+  const int64_t period_us = 10000;
+  unsigned int depth = 6;
+  uint32_t sequence = 0;
+  // Dequeued within a frame period: one buffer being filled, one being read, one waiting
+  for (int window = 0; window < 10; ++window) {
+    depth = policy.update(depth, sequence++, 5000, period_us);
+    depth = policy.update(depth, sequence++, 5000, period_us);
+  }
+  EXPECT_EQ(depth, 3U);
+
+  // Dequeued late, but without skipping frames, doesn't shrink any further
+  depth = policy.update(depth, sequence++, 25000, period_us);
+  depth = policy.update(depth, sequence++, 0, period_us);
+  EXPECT_EQ(depth, 3U);
+}
+
+TEST(test_buffer_depth_policy, stays_within_bounds) {
+  usb_cam::BufferDepthPolicy policy(2, 5, 1);
+  const int64_t period_us = 10000;
+  unsigned int depth = 4;
+  uint32_t sequence = 0;
+  for (int frame = 0; frame < 10; ++frame) {
+    sequence += 2;
+    depth = policy.update(depth, sequence, 0, period_us);
+  }
+  EXPECT_EQ(depth, 5U);
+  for (int frame = 0; frame < 10; ++frame) {
+    depth = policy.update(depth, ++sequence, 0, period_us);
+  }
+  EXPECT_EQ(depth, 2U);
+}
+
+TEST(test_buffer_depth_policy, restarted_sequence_is_not_a_gap) {
+  usb_cam::BufferDepthPolicy policy(2, 8, 2);
+  const int64_t period_us = 10000;
+  unsigned int depth = 4;
+  depth = policy.update(depth, 100, 15000, period_us);
+  depth = policy.update(depth, 0, 15000, period_us);
+  EXPECT_EQ(depth, 4U);
+}
@@ -0,0 +1,174 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <linux/videodev2.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "usb_cam/capability_cache.hpp"
+
+
+namespace
+{
+
+struct v4l2_capability make_capability(const char * card, uint32_t version)
+{
+  struct v4l2_capability capability;
+  memset(&capability, 0, sizeof(capability));
+  strncpy(reinterpret_cast<char *>(capability.driver), "uvcvideo", sizeof(capability.driver));
+  strncpy(reinterpret_cast<char *>(capability.card), card, sizeof(capability.card) - 1);
+  strncpy(
+    reinterpret_cast<char *>(capability.bus_info), "usb-0000:00:14.0-1",
+    sizeof(capability.bus_info));
+  capability.version = version;
+  return capability;
+}
+
+class test_capability_cache_fixture : public ::testing::Test
+{
+public:
+  void SetUp() override
+  {
+    char directory[] = "/tmp/test_capability_cache_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+    m_directory = directory;
+  }
+
+  void TearDown() override
+  {
+    ASSERT_EQ(system(("rm -rf " + m_directory).c_str()), 0);
+  }
+
+  /// @brief Path of the only entry of `kind` in the directory
+  std::string entry_path(const std::string & kind)
+  {
+    std::string path;
+    DIR * directory = opendir(m_directory.c_str());
+    while (struct dirent * entry = readdir(directory)) {
+      if (std::string(entry->d_name).find(kind) != std::string::npos) {
+        path = m_directory + "/" + entry->d_name;
+      }
+    }
+    closedir(directory);
+    return path;
+  }
+
+  std::string m_directory;
+};
+
+}  // namespace
+
+
+TEST_F(test_capability_cache_fixture, round_trip) {
+  usb_cam::CapabilityCache cache(m_directory + "/nested", make_capability("Webcam", 1));
+
+  std::vector<usb_cam::capture_format_t> formats;
+  EXPECT_FALSE(cache.load_formats(formats));
+
+  usb_cam::capture_format_t format;
+  memset(&format, 0, sizeof(format));
+  format.format.pixelformat = V4L2_PIX_FMT_MJPEG;
+  format.v4l2_fmt.width = 1920;
+  format.v4l2_fmt.height = 1080;
+  format.v4l2_fmt.discrete.numerator = 1;
+  format.v4l2_fmt.discrete.denominator = 30;
+  cache.save_formats({format, format});
+
+  ASSERT_TRUE(cache.load_formats(formats));
+  ASSERT_EQ(formats.size(), 2U);
+  EXPECT_EQ(formats[1].format.pixelformat, static_cast<uint32_t>(V4L2_PIX_FMT_MJPEG));
+  EXPECT_EQ(formats[1].v4l2_fmt.width, 1920U);
+  EXPECT_EQ(formats[1].v4l2_fmt.discrete.denominator, 30U);
+
+  // Controls are kept apart from the formats
+  std::vector<struct v4l2_query_ext_ctrl> controls;
+  EXPECT_FALSE(cache.load_controls(controls));
+  struct v4l2_query_ext_ctrl control;
+  memset(&control, 0, sizeof(control));
+  control.id = V4L2_CID_BRIGHTNESS;
+  cache.save_controls({control});
+  ASSERT_TRUE(cache.load_controls(controls));
+  ASSERT_EQ(controls.size(), 1U);
+  EXPECT_EQ(controls[0].id, static_cast<uint32_t>(V4L2_CID_BRIGHTNESS));
+}
+
+TEST_F(test_capability_cache_fixture, keyed_by_device_and_driver) {
+  usb_cam::CapabilityCache cache(m_directory, make_capability("Webcam", 1));
+  usb_cam::capture_format_t format;
+  memset(&format, 0, sizeof(format));
+  cache.save_formats({format});
+
+  std::vector<usb_cam::capture_format_t> formats;
+  EXPECT_FALSE(
+    usb_cam::CapabilityCache(m_directory, make_capability("Other", 1)).load_formats(formats));
+  EXPECT_FALSE(
+    usb_cam::CapabilityCache(m_directory, make_capability("Webcam", 2)).load_formats(formats));
+  EXPECT_TRUE(
+    usb_cam::CapabilityCache(m_directory, make_capability("Webcam", 1)).load_formats(formats));
+}
+
+TEST_F(test_capability_cache_fixture, corrupt_entries_are_missing) {
+  usb_cam::CapabilityCache cache(m_directory, make_capability("Webcam", 1));
+  usb_cam::capture_format_t format;
+  memset(&format, 0, sizeof(format));
+  cache.save_formats({format, format});
+  const std::string path = entry_path("formats");
+  ASSERT_FALSE(path.empty());
+
+  // Cut short within the last record
+  std::vector<usb_cam::capture_format_t> formats;
+  ASSERT_EQ(truncate(path.c_str(), sizeof(uint32_t) * 4 + cache.key().size() + sizeof(format)), 0);
+  EXPECT_FALSE(cache.load_formats(formats));
+
+  // A count far beyond what the file holds is not allocated
+  cache.save_formats({format, format});
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(sizeof(uint32_t) * 3 + cache.key().size());
+    const uint32_t count = 0xFFFFFFFF;
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  }
+  EXPECT_FALSE(cache.load_formats(formats));
+  EXPECT_TRUE(formats.empty());
+}
+
+TEST(test_capability_cache, disabled_without_directory) {
+  usb_cam::CapabilityCache cache("", make_capability("Webcam", 1));
+  cache.save_formats({});
+  std::vector<usb_cam::capture_format_t> formats;
+  EXPECT_FALSE(cache.load_formats(formats));
+}
@@ -0,0 +1,119 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <linux/videodev2.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "usb_cam/capture_stats.hpp"
+
+
+TEST(test_capture_stats, counts_sequence_gaps_and_errors) {
+  usb_cam::CaptureStats stats;
+  stats.record_dequeue(10, 0, 1000);
+  stats.record_dequeue(11, 0, 3000);
+  stats.record_dequeue(14, V4L2_BUF_FLAG_ERROR, 2000);
+  stats.record_skip();
+  stats.record_corrupt();
+
+  auto snapshot = stats.snapshot();
+  EXPECT_EQ(snapshot.frames, 3U);
+  EXPECT_EQ(snapshot.driver_dropped_frames, 2U);
+  EXPECT_EQ(snapshot.error_frames, 1U);
+  EXPECT_EQ(snapshot.skipped_frames, 1U);
+  EXPECT_EQ(snapshot.corrupt_frames, 1U);
+  EXPECT_EQ(snapshot.last_dequeue_lag_us, 2000);
+  EXPECT_EQ(snapshot.max_dequeue_lag_us, 3000);
+
+  // Streaming restarted, the sequence starts over without dropping anything
+  stats.restart_sequence();
+  stats.record_dequeue(0, 0, 1000);
+  stats.record_dequeue(1, 0, 1000);
+  EXPECT_EQ(stats.snapshot().driver_dropped_frames, 2U);
+}
+
+TEST(test_capture_stats, records_publishing) {
+  usb_cam::CaptureStats stats;
+  stats.record_publish(500);
+  stats.record_publish(200);
+  stats.record_publish_drop();
+
+  auto snapshot = stats.snapshot();
+  EXPECT_EQ(snapshot.last_publish_lag_us, 200);
+  EXPECT_EQ(snapshot.max_publish_lag_us, 500);
+  EXPECT_EQ(snapshot.publish_dropped_frames, 1U);
+}
+
+TEST(test_capture_stats, records_outages) {
+  usb_cam::CaptureStats stats;
+  EXPECT_FALSE(stats.snapshot().disconnected);
+
+  stats.record_disconnect();
+  auto snapshot = stats.snapshot();
+  EXPECT_TRUE(snapshot.disconnected);
+  EXPECT_EQ(snapshot.disconnects, 1U);
+  EXPECT_EQ(snapshot.last_outage_us, 0);
+
+  stats.record_reconnect(250000);
+  snapshot = stats.snapshot();
+  EXPECT_FALSE(snapshot.disconnected);
+  EXPECT_EQ(snapshot.disconnects, 1U);
+  EXPECT_EQ(snapshot.last_outage_us, 250000);
+}
+
+TEST(test_capture_stats, read_while_recording) {
+  usb_cam::CaptureStats stats;
+  const uint32_t number_of_frames = 100000;
+  std::atomic<bool> done{false};
+
+  std::thread capture([&]() {
+      for (uint32_t sequence = 0; sequence < number_of_frames; ++sequence) {
+        // Every other frame dropped by the driver
+        stats.record_dequeue(2 * sequence, 0, sequence);
+      }
+      done = true;
+    });
+
+  uint64_t frames = 0;
+  while (!done) {
+    auto snapshot = stats.snapshot();
+    // Counters only ever grow
+    EXPECT_GE(snapshot.frames, frames);
+    frames = snapshot.frames;
+  }
+  capture.join();
+
+  auto snapshot = stats.snapshot();
+  EXPECT_EQ(snapshot.frames, number_of_frames);
+  EXPECT_EQ(snapshot.driver_dropped_frames, number_of_frames - 1);
+  EXPECT_EQ(snapshot.max_dequeue_lag_us, number_of_frames - 1);
+}
@@ -0,0 +1,169 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "usb_cam/decoder_pipeline.hpp"
+#include "usb_cam/formats/pixel_format_base.hpp"
+
+
+/// @brief Fake decoder filling the output with the first input byte. Earlier frames take
+/// longer to decode so that they finish out of order. A negative first byte marks a frame
+/// that fails to decode.
+class fill_decoder : public usb_cam::formats::pixel_format_base
+{
+public:
+  explicit fill_decoder(const size_t & output_size)
+  : pixel_format_base("fill", 0, "mono8", 1, 8, true),
+    m_output_size(output_size)
+  {}
+
+  bool convert(const char * & src, char * & dest, const int & bytes_used) override
+  {
+    (void)bytes_used;
+    std::this_thread::sleep_for(std::chrono::milliseconds(8 - (src[0] % 4) * 2));
+    if (src[0] < 0) {
+      return false;
+    }
+    memset(dest, src[0], m_output_size);
+    return true;
+  }
+
+private:
+  size_t m_output_size;
+};
+
+std::vector<std::shared_ptr<usb_cam::formats::pixel_format_base>> make_decoders(
+  const size_t & count, const size_t & output_size)
+{
+  std::vector<std::shared_ptr<usb_cam::formats::pixel_format_base>> decoders;
+  for (size_t i = 0; i < count; ++i) {
+    decoders.push_back(std::make_shared<fill_decoder>(output_size));
+  }
+  return decoders;
+}
+
+TEST(test_decoder_pipeline, output_in_capture_order) {
+  const size_t output_size = 16;
+  usb_cam::DecoderPipeline pipeline(make_decoders(4, output_size), output_size);
+  ASSERT_EQ(pipeline.depth(), 4U);
+
+  std::vector<char> dest(output_size);
+  uint32_t sequence;
+  timespec stamp{};
+  uint32_t expected = 0;
+  for (uint32_t frame = 0; frame < 32; ++frame) {
+    const char src[1] = {static_cast<char>(frame)};
+    const timespec frame_stamp{static_cast<time_t>(frame), 0};
+    pipeline.submit(src, sizeof(src), frame, frame_stamp);
+    if (pipeline.in_flight() < pipeline.depth()) {
+      continue;
+    }
+    ASSERT_TRUE(pipeline.pop(dest.data(), sequence, stamp));
+    EXPECT_EQ(sequence, expected);
+    EXPECT_EQ(stamp.tv_sec, static_cast<time_t>(expected));
+    EXPECT_EQ(dest[0], static_cast<char>(expected));
+    EXPECT_EQ(dest[output_size - 1], static_cast<char>(expected));
+    ++expected;
+  }
+  // the first depth - 1 frames only filled the pipeline
+  EXPECT_EQ(expected, 32U - 3U);
+  while (pipeline.pop(dest.data(), sequence, stamp)) {
+    EXPECT_EQ(sequence, expected++);
+  }
+  EXPECT_EQ(expected, 32U);
+}
+
+TEST(test_decoder_pipeline, sequence_wraps_around) {
+  const size_t output_size = 4;
+  usb_cam::DecoderPipeline pipeline(make_decoders(2, output_size), output_size);
+
+  std::vector<char> dest(output_size);
+  uint32_t sequence;
+  timespec stamp{};
+  const char src[1] = {1};
+  pipeline.submit(src, sizeof(src), 0xFFFFFFFFu, stamp);
+  pipeline.submit(src, sizeof(src), 0u, stamp);
+  ASSERT_TRUE(pipeline.pop(dest.data(), sequence, stamp));
+  EXPECT_EQ(sequence, 0xFFFFFFFFu);
+  ASSERT_TRUE(pipeline.pop(dest.data(), sequence, stamp));
+  EXPECT_EQ(sequence, 0u);
+}
+
+TEST(test_decoder_pipeline, undecodable_frame_is_dropped) {
+  const size_t output_size = 4;
+  usb_cam::DecoderPipeline pipeline(make_decoders(2, output_size), output_size);
+
+  std::vector<char> dest(output_size, 7);
+  uint32_t sequence = 0;
+  timespec stamp{};
+  const char corrupt[1] = {-1};
+  const char src[1] = {3};
+  pipeline.submit(corrupt, sizeof(corrupt), 20, stamp);
+  pipeline.submit(src, sizeof(src), 21, stamp);
+  EXPECT_FALSE(pipeline.pop(dest.data(), sequence, stamp));
+  EXPECT_EQ(dest[0], 7);
+  EXPECT_EQ(pipeline.in_flight(), 1U);
+  ASSERT_TRUE(pipeline.pop(dest.data(), sequence, stamp));
+  EXPECT_EQ(sequence, 21u);
+  EXPECT_EQ(dest[0], 3);
+}
+
+TEST(test_decoder_pipeline, flush_drops_frames_in_flight) {
+  const size_t output_size = 4;
+  usb_cam::DecoderPipeline pipeline(make_decoders(3, output_size), output_size);
+
+  const char src[1] = {2};
+  const timespec stamp{};
+  pipeline.submit(src, sizeof(src), 10, stamp);
+  pipeline.submit(src, sizeof(src), 11, stamp);
+  pipeline.flush();
+  EXPECT_EQ(pipeline.in_flight(), 0U);
+
+  std::vector<char> dest(output_size);
+  uint32_t sequence;
+  timespec popped_stamp{};
+  EXPECT_FALSE(pipeline.pop(dest.data(), sequence, popped_stamp));
+}
+
+TEST(test_decoder_pipeline, submit_into_busy_slot_throws) {
+  const size_t output_size = 4;
+  usb_cam::DecoderPipeline pipeline(make_decoders(1, output_size), output_size);
+
+  const char src[1] = {3};
+  const timespec stamp{};
+  pipeline.submit(src, sizeof(src), 0, stamp);
+  EXPECT_THROW(pipeline.submit(src, sizeof(src), 1, stamp), std::runtime_error);
+}
@@ -0,0 +1,119 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "usb_cam/device_watcher.hpp"
+
+
+namespace
+{
+
+class test_device_watcher_fixture : public ::testing::Test
+{
+public:
+  void SetUp() override
+  {
+    char directory[] = "/tmp/test_device_watcher_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+    m_directory = directory;
+  }
+
+  void TearDown() override
+  {
+    ASSERT_EQ(system(("rm -rf " + m_directory).c_str()), 0);
+  }
+
+  void create(const std::string & name)
+  {
+    const int fd = open((m_directory + "/" + name).c_str(), O_CREAT | O_WRONLY, 0600);
+    ASSERT_NE(fd, -1);
+    close(fd);
+  }
+
+  /// @brief True if the watcher's fd became readable within `timeout_ms`
+  static bool readable(const usb_cam::DeviceWatcher & watcher, int timeout_ms)
+  {
+    struct pollfd pfd = {watcher.fd(), POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) == 1;
+  }
+
+  std::string m_directory;
+};
+
+}  // namespace
+
+
+TEST_F(test_device_watcher_fixture, reports_the_device_appearing) {
+  usb_cam::DeviceWatcher watcher(m_directory + "/video0");
+  ASSERT_TRUE(watcher.is_watching());
+  EXPECT_FALSE(watcher.consume());
+
+  create("video0");
+  ASSERT_TRUE(readable(watcher, 1000));
+  EXPECT_TRUE(watcher.consume());
+  // Everything pending was read
+  EXPECT_FALSE(readable(watcher, 0));
+  EXPECT_FALSE(watcher.consume());
+
+  // udev setting the permissions after the kernel created the node
+  ASSERT_EQ(chmod((m_directory + "/video0").c_str(), 0660), 0);
+  ASSERT_TRUE(readable(watcher, 1000));
+  EXPECT_TRUE(watcher.consume());
+}
+
+TEST_F(test_device_watcher_fixture, ignores_other_devices) {
+  usb_cam::DeviceWatcher watcher(m_directory + "/video0");
+  create("video1");
+  ASSERT_TRUE(readable(watcher, 1000));
+  EXPECT_FALSE(watcher.consume());
+}
+
+TEST_F(test_device_watcher_fixture, reports_losing_the_directory) {
+  usb_cam::DeviceWatcher watcher(m_directory + "/by-id/usb-camera");
+  // Nothing to watch yet
+  EXPECT_FALSE(watcher.is_watching());
+  EXPECT_FALSE(watcher.consume());
+
+  ASSERT_EQ(mkdir((m_directory + "/by-id").c_str(), 0700), 0);
+  usb_cam::DeviceWatcher by_id_watcher(m_directory + "/by-id/usb-camera");
+  ASSERT_TRUE(by_id_watcher.is_watching());
+  ASSERT_EQ(rmdir((m_directory + "/by-id").c_str()), 0);
+  // Removing the directory can't be missed, the caller has to retry on its own from then on
+  ASSERT_TRUE(readable(by_id_watcher, 1000));
+  EXPECT_TRUE(by_id_watcher.consume());
+  EXPECT_FALSE(by_id_watcher.is_watching());
+}
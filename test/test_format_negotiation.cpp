@@ -0,0 +1,140 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <linux/videodev2.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "usb_cam/format_negotiation.hpp"
+
+
+namespace
+{
+
+usb_cam::capture_format_t make_format(uint32_t pixel_format, int width, int height, int fps)
+{
+  usb_cam::capture_format_t format;
+  memset(&format, 0, sizeof(format));
+  format.format.pixelformat = pixel_format;
+  format.size.type = V4L2_FRMSIZE_TYPE_DISCRETE;
+  format.size.discrete.width = width;
+  format.size.discrete.height = height;
+  format.v4l2_fmt.type = V4L2_FRMIVAL_TYPE_DISCRETE;
+  format.v4l2_fmt.pixel_format = pixel_format;
+  format.v4l2_fmt.width = width;
+  format.v4l2_fmt.height = height;
+  format.v4l2_fmt.discrete.numerator = 1;
+  format.v4l2_fmt.discrete.denominator = fps;
+  return format;
+}
+
+}  // namespace
+
+
+TEST(test_format_negotiation, mjpeg_when_yuyv_is_too_slow) {
+  // A typical UVC webcam: uncompressed full HD only at 5 fps
+  const std::vector<usb_cam::capture_format_t> formats = {
+    make_format(V4L2_PIX_FMT_YUYV, 1920, 1080, 5),
+    make_format(V4L2_PIX_FMT_YUYV, 640, 480, 30),
+    make_format(V4L2_PIX_FMT_MJPEG, 1920, 1080, 30),
+    make_format(V4L2_PIX_FMT_MJPEG, 640, 480, 30),
+  };
+
+  auto choice = usb_cam::choose_pixel_format(formats, 1920, 1080, 30);
+  EXPECT_EQ(choice.pixel_format_name, "mjpeg2rgb");
+  EXPECT_EQ(choice.output_encoding, "rgb8");
+  EXPECT_DOUBLE_EQ(choice.frame_rate, 30.0);
+  EXPECT_NE(choice.reason.find("yuyv2rgb only does 5 fps"), std::string::npos);
+
+  // Small enough for the bus uncompressed, which is much cheaper to convert
+  choice = usb_cam::choose_pixel_format(formats, 640, 480, 30);
+  EXPECT_EQ(choice.pixel_format_name, "yuyv2rgb");
+}
+
+TEST(test_format_negotiation, limited_by_usb_bandwidth) {
+  const std::vector<usb_cam::capture_format_t> formats = {
+    make_format(V4L2_PIX_FMT_YUYV, 1280, 720, 30),
+    make_format(V4L2_PIX_FMT_MJPEG, 1280, 720, 30),
+  };
+  // 1280x720 YUYV at 30 fps needs 55 MB/s
+  auto choice = usb_cam::choose_pixel_format(formats, 1280, 720, 30);
+  EXPECT_EQ(choice.pixel_format_name, "mjpeg2rgb");
+  EXPECT_NE(choice.reason.find("yuyv2rgb needs"), std::string::npos);
+
+  choice = usb_cam::choose_pixel_format(formats, 1280, 720, 30, 400e6);
+  EXPECT_EQ(choice.pixel_format_name, "yuyv2rgb");
+}
+
+TEST(test_format_negotiation, color_before_mono) {
+  std::vector<usb_cam::capture_format_t> formats = {
+    make_format(V4L2_PIX_FMT_GREY, 640, 480, 30),
+    make_format(V4L2_PIX_FMT_YUYV, 640, 480, 30),
+  };
+  EXPECT_EQ(usb_cam::choose_pixel_format(formats, 640, 480, 30).pixel_format_name, "yuyv2rgb");
+
+  formats.pop_back();
+  EXPECT_EQ(usb_cam::choose_pixel_format(formats, 640, 480, 30).pixel_format_name, "mono8");
+}
+
+TEST(test_format_negotiation, fastest_when_none_qualifies) {
+  const std::vector<usb_cam::capture_format_t> formats = {
+    make_format(V4L2_PIX_FMT_YUYV, 1920, 1080, 5),
+    make_format(V4L2_PIX_FMT_MJPEG, 1920, 1080, 15),
+  };
+  auto choice = usb_cam::choose_pixel_format(formats, 1920, 1080, 60);
+  EXPECT_EQ(choice.pixel_format_name, "mjpeg2rgb");
+  EXPECT_DOUBLE_EQ(choice.frame_rate, 15.0);
+}
+
+TEST(test_format_negotiation, stepwise_sizes) {
+  auto smallest = make_format(V4L2_PIX_FMT_YUYV, 160, 120, 60);
+  auto largest = make_format(V4L2_PIX_FMT_YUYV, 1280, 960, 30);
+  for (auto format : {&smallest, &largest}) {
+    format->size.type = V4L2_FRMSIZE_TYPE_STEPWISE;
+    format->size.stepwise = {160, 1280, 16, 120, 960, 8};
+  }
+  const std::vector<usb_cam::capture_format_t> formats = {smallest, largest};
+
+  auto choice = usb_cam::choose_pixel_format(formats, 640, 480, 30);
+  EXPECT_EQ(choice.pixel_format_name, "yuyv2rgb");
+  // Only the rate at the largest size is relied on
+  EXPECT_DOUBLE_EQ(choice.frame_rate, 30.0);
+
+  EXPECT_THROW(usb_cam::choose_pixel_format(formats, 650, 480, 30), std::invalid_argument);
+}
+
+TEST(test_format_negotiation, no_format_at_size) {
+  const std::vector<usb_cam::capture_format_t> formats = {
+    make_format(V4L2_PIX_FMT_YUYV, 640, 480, 30),
+  };
+  EXPECT_THROW(usb_cam::choose_pixel_format(formats, 1920, 1080, 30), std::invalid_argument);
+}
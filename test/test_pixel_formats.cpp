@@ -31,7 +31,17 @@
 
 #include <linux/videodev2.h>
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "usb_cam/formats/mjpeg.hpp"
 #include "usb_cam/formats/pixel_format_base.hpp"
+#include "usb_cam/formats/simd.hpp"
+#include "usb_cam/formats/uyvy.hpp"
+#include "usb_cam/formats/yuyv.hpp"
+#include "usb_cam/formats/yvyu.hpp"
 
 TEST(test_pixel_formats, pixel_format_base_class) {
   auto test_pix_fmt = usb_cam::formats::default_pixel_format();
@@ -47,3 +57,140 @@ TEST(test_pixel_formats, pixel_format_base_class) {
   EXPECT_EQ(test_pix_fmt.is_color(), false);
   EXPECT_EQ(test_pix_fmt.is_mono(), false);
 }
+
+TEST(test_pixel_formats, mjpeg_passthrough) {
+  usb_cam::formats::MJPEG test_pix_fmt;
+
+  EXPECT_EQ(test_pix_fmt.name(), "mjpeg");
+  EXPECT_EQ(test_pix_fmt.v4l2(), V4L2_PIX_FMT_MJPEG);
+  EXPECT_EQ(test_pix_fmt.ros(), "jpeg");
+  EXPECT_EQ(test_pix_fmt.requires_conversion(), false);
+  EXPECT_EQ(test_pix_fmt.is_compressed(), true);
+
+  EXPECT_EQ(usb_cam::formats::default_pixel_format().is_compressed(), false);
+}
+
+TEST(test_pixel_formats, mjpeg2rgb_decode_scale) {
+  usb_cam::formats::MJPEG2RGB full_scale(640, 480);
+  EXPECT_EQ(full_scale.decode_scale(), 1);
+
+  usb_cam::formats::MJPEG2RGB quarter_scale(640, 480, 4);
+  EXPECT_EQ(quarter_scale.decode_scale(), 4);
+
+  EXPECT_THROW(usb_cam::formats::MJPEG2RGB(640, 480, 3), std::invalid_argument);
+}
+
+TEST(test_pixel_formats, mjpeg2mono8) {
+  usb_cam::formats::MJPEG2MONO8 test_pix_fmt(640, 480, 2);
+
+  EXPECT_EQ(test_pix_fmt.name(), "mjpeg2mono8");
+  EXPECT_EQ(test_pix_fmt.v4l2(), V4L2_PIX_FMT_MJPEG);
+  EXPECT_EQ(test_pix_fmt.channels(), 1);
+  EXPECT_EQ(test_pix_fmt.requires_conversion(), true);
+  EXPECT_EQ(test_pix_fmt.is_mono(), true);
+  EXPECT_EQ(test_pix_fmt.decode_scale(), 2);
+}
+
+template<typename Order>
+void expect_simd_matches_scalar()
+{
+  // Cover every (u, v) pair with varying luma, plus an odd tail the vector loops can't handle
+  const int number_of_pixels = 2 * 256 * 256 + 6;
+  std::vector<unsigned char> src(number_of_pixels * 2);
+  for (size_t i = 0; i < src.size() / 4; i++) {
+    src[4 * i + Order::y0] = static_cast<unsigned char>(i * 7);
+    src[4 * i + Order::u] = static_cast<unsigned char>(i >> 8);
+    src[4 * i + Order::y1] = static_cast<unsigned char>(255 - i * 13);
+    src[4 * i + Order::v] = static_cast<unsigned char>(i);
+  }
+
+  std::vector<unsigned char> expected(number_of_pixels * 3);
+  usb_cam::formats::yuv422_to_rgb_scalar<Order>(src.data(), expected.data(), number_of_pixels);
+
+  for (int level = usb_cam::formats::SIMD_LEVEL_SSE41;
+    level <= usb_cam::formats::get_simd_level(); level++)
+  {
+    std::vector<unsigned char> actual(number_of_pixels * 3);
+    usb_cam::formats::yuv422_to_rgb<Order>(
+      src.data(), actual.data(), number_of_pixels,
+      static_cast<usb_cam::formats::simd_level_t>(level));
+    EXPECT_EQ(expected, actual) << "SIMD level " << level;
+  }
+}
+
+TEST(test_pixel_formats, yuv422_simd_matches_scalar) {
+  expect_simd_matches_scalar<usb_cam::formats::yuyv_order>();
+  expect_simd_matches_scalar<usb_cam::formats::uyvy_order>();
+  expect_simd_matches_scalar<usb_cam::formats::yvyu_order>();
+}
+
+TEST(test_pixel_formats, yuyv2rgb_convert) {
+  auto test_pix_fmt = usb_cam::formats::YUYV2RGB(2);
+
+  // Black and white macropixel with neutral chroma
+  const char yuyv[] = {0, -128, -1, -128};
+  char rgb[6];
+  const char * src = yuyv;
+  char * dest = rgb;
+  test_pix_fmt.convert(src, dest, sizeof(yuyv));
+
+  EXPECT_EQ(rgb[0], 0);
+  EXPECT_EQ(rgb[1], 0);
+  EXPECT_EQ(rgb[2], 0);
+  EXPECT_EQ(static_cast<unsigned char>(rgb[3]), 255);
+  EXPECT_EQ(static_cast<unsigned char>(rgb[4]), 255);
+  EXPECT_EQ(static_cast<unsigned char>(rgb[5]), 255);
+}
+
+TEST(test_pixel_formats, yuv422_byte_order) {
+  // The same two pixels in each packed layout must convert to the same RGB
+  const char yuyv[] = {20, 90, -36, -16};
+  const char uyvy[] = {90, 20, -16, -36};
+  const char yvyu[] = {20, -16, -36, 90};
+  char rgb_yuyv[6], rgb_uyvy[6], rgb_yvyu[6];
+
+  auto yuyv2rgb = usb_cam::formats::YUYV2RGB(2);
+  auto uyvy2rgb = usb_cam::formats::UYVY2RGB(2);
+  auto yvyu2rgb = usb_cam::formats::YVYU2RGB(2);
+  const char * src = yuyv;
+  char * dest = rgb_yuyv;
+  yuyv2rgb.convert(src, dest, sizeof(yuyv));
+  src = uyvy;
+  dest = rgb_uyvy;
+  uyvy2rgb.convert(src, dest, sizeof(uyvy));
+  src = yvyu;
+  dest = rgb_yvyu;
+  yvyu2rgb.convert(src, dest, sizeof(yvyu));
+
+  EXPECT_EQ(0, memcmp(rgb_yuyv, rgb_uyvy, sizeof(rgb_yuyv)));
+  EXPECT_EQ(0, memcmp(rgb_yuyv, rgb_yvyu, sizeof(rgb_yuyv)));
+  EXPECT_EQ(uyvy2rgb.channels(), 3);
+}
+
+TEST(test_pixel_formats, convert_in_bands) {
+  // Converting a frame as bands of rows must give the same result as a single convert
+  const size_t width = 64;
+  const size_t height = 30;
+  std::vector<char> src(width * height * 2);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = static_cast<char>(i * 31);
+  }
+
+  auto test_pix_fmt = usb_cam::formats::YUYV2RGB(width * height);
+  ASSERT_TRUE(test_pix_fmt.is_band_splittable());
+
+  std::vector<char> expected(width * height * 3);
+  const char * src_ptr = src.data();
+  char * dest_ptr = expected.data();
+  test_pix_fmt.convert(src_ptr, dest_ptr, src.size());
+
+  std::vector<char> actual(width * height * 3);
+  const size_t rows_per_band = 7;
+  for (size_t row = 0; row < height; row += rows_per_band) {
+    const size_t rows = std::min(rows_per_band, height - row);
+    test_pix_fmt.convert_band(src.data(), actual.data(), row * width, rows * width);
+  }
+  EXPECT_EQ(expected, actual);
+
+  EXPECT_FALSE(usb_cam::formats::default_pixel_format().is_band_splittable());
+}
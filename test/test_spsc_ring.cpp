@@ -0,0 +1,110 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "usb_cam/spsc_ring.hpp"
+
+
+TEST(test_spsc_ring, push_pop_in_order) {
+  usb_cam::SpscRing<uint32_t> ring(3);
+  EXPECT_TRUE(ring.empty());
+
+  uint32_t value = 0;
+  EXPECT_FALSE(ring.try_pop(value));
+  EXPECT_TRUE(ring.try_push(1));
+  EXPECT_TRUE(ring.try_push(2));
+  EXPECT_TRUE(ring.try_push(3));
+  EXPECT_FALSE(ring.try_push(4));
+  EXPECT_EQ(ring.size(), 3U);
+
+  EXPECT_TRUE(ring.try_pop(value));
+  EXPECT_EQ(value, 1U);
+  EXPECT_TRUE(ring.try_push(4));
+  for (uint32_t expected = 2; expected <= 4; ++expected) {
+    EXPECT_TRUE(ring.try_pop(value));
+    EXPECT_EQ(value, expected);
+  }
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(test_spsc_ring, drop_oldest) {
+  usb_cam::SpscRing<uint32_t> ring(2);
+  uint32_t value = 0;
+  EXPECT_FALSE(ring.drop_oldest(value));
+
+  ring.try_push(1);
+  ring.try_push(2);
+  EXPECT_TRUE(ring.drop_oldest(value));
+  EXPECT_EQ(value, 1U);
+  EXPECT_TRUE(ring.try_push(3));
+  EXPECT_TRUE(ring.try_pop(value));
+  EXPECT_EQ(value, 2U);
+  EXPECT_TRUE(ring.try_pop(value));
+  EXPECT_EQ(value, 3U);
+}
+
+TEST(test_spsc_ring, concurrent_drop_oldest_keeps_order) {
+  // The producer drops the oldest value whenever the ring is full, the consumer must
+  // still see strictly increasing values and every value at most once
+  const uint32_t count = 200000;
+  usb_cam::SpscRing<uint32_t> ring(4);
+  std::atomic<bool> done(false);
+  std::vector<uint32_t> received;
+
+  std::thread consumer([&]() {
+      uint32_t value;
+      while (!done.load() || !ring.empty()) {
+        if (ring.try_pop(value)) {
+          received.push_back(value);
+        }
+      }
+    });
+
+  uint32_t dropped = 0;
+  uint32_t value;
+  for (uint32_t i = 0; i < count; ++i) {
+    while (!ring.try_push(i)) {
+      if (ring.drop_oldest(value)) {
+        ++dropped;
+      }
+    }
+  }
+  done = true;
+  consumer.join();
+
+  EXPECT_EQ(received.size() + dropped, count);
+  for (size_t i = 1; i < received.size(); ++i) {
+    ASSERT_LT(received[i - 1], received[i]);
+  }
+}
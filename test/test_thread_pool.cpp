@@ -0,0 +1,80 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "usb_cam/thread_pool.hpp"
+
+
+TEST(test_thread_pool, runs_every_task_once) {
+  usb_cam::ThreadPool pool(4);
+  ASSERT_EQ(pool.size(), 4U);
+
+  // Reuse the same pool for many batches, as is done for every frame
+  for (size_t batch = 0; batch < 100; batch++) {
+    std::vector<std::atomic<int>> counts(batch + 1);
+    for (auto & count : counts) {
+      count = 0;
+    }
+    pool.run(counts.size(), [&counts](size_t i) {counts[i]++;});
+    for (auto & count : counts) {
+      EXPECT_EQ(count, 1);
+    }
+  }
+}
+
+TEST(test_thread_pool, single_thread) {
+  usb_cam::ThreadPool pool(1);
+  ASSERT_EQ(pool.size(), 1U);
+
+  size_t sum = 0;
+  pool.run(10, [&sum](size_t i) {sum += i;});
+  EXPECT_EQ(sum, 45U);
+}
+
+TEST(test_thread_pool, rethrows_task_exception) {
+  usb_cam::ThreadPool pool(3);
+
+  EXPECT_THROW(
+    pool.run(
+      8, [](size_t i) {
+        if (i == 5) {
+          throw std::runtime_error("task failed");
+        }
+      }),
+    std::runtime_error);
+
+  // Pool is still usable afterwards
+  std::atomic<size_t> count{0};
+  pool.run(8, [&count](size_t) {count++;});
+  EXPECT_EQ(count, 8U);
+}
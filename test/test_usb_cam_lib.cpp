@@ -27,10 +27,17 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #include <gtest/gtest.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
 #include <malloc.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <string>
 #include <thread>
 
 #include "usb_cam/usb_cam.hpp"
@@ -78,11 +85,44 @@ public:
     true,
     true,
     false,
+    1,
+    1,
+    1,
+    4,
+    30,
+    false,
+    4,
+    false,
+    false,
   };
 
   usb_cam::UsbCam * m_test_cam = new usb_cam::UsbCam();
 };
 
+/// @brief Path of a capture device of the `vivid` virtual video test driver, which runs
+/// without any camera attached (`sudo modprobe vivid`), or an empty string if none is loaded
+std::string find_vivid_device()
+{
+  for (int i = 0; i < 64; ++i) {
+    const std::string path = "/dev/video" + std::to_string(i);
+    const int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd == -1) {
+      continue;
+    }
+    struct v4l2_capability capability;
+    memset(&capability, 0, sizeof(capability));
+    const bool vivid = 0 == ioctl(fd, VIDIOC_QUERYCAP, &capability) &&
+      std::string(reinterpret_cast<const char *>(capability.driver)) == "vivid" &&
+      (capability.device_caps & V4L2_CAP_VIDEO_CAPTURE) &&
+      (capability.device_caps & V4L2_CAP_STREAMING);
+    close(fd);
+    if (vivid) {
+      return path;
+    }
+  }
+  return "";
+}
+
 }  // namespace
 
 
@@ -122,11 +162,117 @@ TEST_F(test_usb_cam_lib_fixture, usb_cam_class_basic_get_image) {
   ASSERT_EQ(m_test_cam->is_capturing(), true);
 }
 
+TEST_F(test_usb_cam_lib_fixture, usb_cam_class_interrupt_get_image) {
+  // A pending interrupt makes the next wait for a frame return without an image
+  m_test_cam->interrupt();
+  ASSERT_EQ(m_test_cam->get_image(), nullptr);
+  ASSERT_NE(m_test_cam->get_image(), nullptr);
+}
+
+TEST_F(test_usb_cam_lib_fixture, usb_cam_class_zero_copy_get_frame) {
+  auto frame = m_test_cam->get_frame();
+  ASSERT_TRUE(frame);
+  ASSERT_NE(frame.data(), nullptr);
+  ASSERT_GT(frame.bytes_used(), 0U);
+  ASSERT_GT(frame.timestamp().tv_sec, 0);
+  const uint32_t sequence = frame.sequence();
+
+  // Releasing hands the buffer back, so the driver can keep capturing into every buffer
+  frame.release();
+  ASSERT_FALSE(frame);
+  for (unsigned int i = 0; i < m_test_cam->number_of_buffers() + 1; ++i) {
+    frame = m_test_cam->get_frame();
+    ASSERT_TRUE(frame);
+  }
+  ASSERT_GT(frame.sequence(), sequence);
+}
+
+TEST_F(test_usb_cam_lib_fixture, usb_cam_class_export_dmabufs) {
+  auto dmabuf_fds = m_test_cam->export_dmabufs();
+  ASSERT_EQ(dmabuf_fds.size(), m_test_cam->number_of_buffers());
+  // Exported once, the same fds are handed out again
+  ASSERT_EQ(m_test_cam->export_dmabufs(), dmabuf_fds);
+
+  // Import the buffer holding a frame the way another process would, by mapping the
+  // DMABUF, and check it holds the same frame as the driver's buffer
+  auto frame = m_test_cam->get_frame();
+  ASSERT_TRUE(frame);
+  ASSERT_LT(frame.index(), dmabuf_fds.size());
+  const int dmabuf_fd = dmabuf_fds[frame.index()];
+  void * imported = mmap(NULL, frame.bytes_used(), PROT_READ, MAP_SHARED, dmabuf_fd, 0);
+  ASSERT_NE(imported, MAP_FAILED);
+  EXPECT_EQ(memcmp(imported, frame.data(), frame.bytes_used()), 0);
+  munmap(imported, frame.bytes_used());
+}
+
+TEST(test_usb_cam_lib, export_dmabufs_of_virtual_device) {
+  const std::string device_name = find_vivid_device();
+  if (device_name.empty()) {
+    GTEST_SKIP() << "No vivid device, load it with `modprobe vivid` to run this test";
+  }
+
+  usb_cam::parameters_t parameters{
+    "test_camera", device_name, "test_camera_frame", "mmap",
+    "package://usb_cam/config/camera_info.yaml", "yuyv",
+    640, 480, 30, -1, -1, -1, -1, -1, -1, -1, -1, true, true, false,
+    1, 1, 1, 4, 30, false, 4, false, false,
+  };
+  usb_cam::UsbCam camera;
+  camera.assign_parameters(parameters);
+  camera.configure();
+  camera.start();
+
+  auto dmabuf_fds = camera.export_dmabufs();
+  ASSERT_EQ(dmabuf_fds.size(), camera.number_of_buffers());
+  ASSERT_EQ(camera.export_dmabufs(), dmabuf_fds);
+
+  auto frame = camera.get_frame();
+  ASSERT_TRUE(frame);
+  ASSERT_LT(frame.index(), dmabuf_fds.size());
+  void * imported =
+    mmap(NULL, frame.bytes_used(), PROT_READ, MAP_SHARED, dmabuf_fds[frame.index()], 0);
+  ASSERT_NE(imported, MAP_FAILED);
+  EXPECT_EQ(memcmp(imported, frame.data(), frame.bytes_used()), 0);
+  munmap(imported, frame.bytes_used());
+}
+
 TEST_F(test_usb_cam_lib_fixture, usb_cam_class_one_copy_get_image) {
   // Pre-allocate image
   char * test_image = reinterpret_cast<char *>(malloc(m_test_cam->get_image_size()));
   // Pass in pointer
   m_test_cam->get_image(test_image);
   ASSERT_NE(test_image, nullptr);
+}
+
+TEST_F(test_usb_cam_lib_fixture, usb_cam_class_user_buffers_require_userptr) {
+  std::vector<char> storage(m_test_cam->get_capture_buffer_size());
+  std::vector<usb_cam::utils::buffer> buffers{{storage.data(), storage.size(), -1}};
+  // The fixture captures into driver allocated (mmap) buffers
+  ASSERT_THROW(m_test_cam->set_user_buffers(buffers), std::invalid_argument);
+}
+
+TEST_F(test_usb_cam_lib_fixture, usb_cam_class_reconfigure) {
+  auto parameters = m_test_parameters;
+  parameters.image_width = 320;
+  parameters.image_height = 240;
+  m_test_cam->reconfigure(parameters);
+  ASSERT_EQ(m_test_cam->get_image_width(), size_t(320));
+  ASSERT_EQ(m_test_cam->get_image_height(), size_t(240));
+  ASSERT_EQ(m_test_cam->get_image_size(), size_t(230400));
+  // Still capturing, into buffers of the new size
+  ASSERT_EQ(m_test_cam->is_capturing(), true);
+  ASSERT_NE(m_test_cam->get_image(), nullptr);
+
+  // A rejected change leaves the camera stopped, until it goes back to parameters it accepts
+  auto rejected = parameters;
+  rejected.pixel_format_name = "not_a_pixel_format";
+  ASSERT_THROW(m_test_cam->reconfigure(rejected), std::invalid_argument);
+  m_test_cam->reconfigure(parameters);
+  m_test_cam->start_capturing();
+  ASSERT_EQ(m_test_cam->get_image_width(), size_t(320));
+  ASSERT_NE(m_test_cam->get_image(), nullptr);
 
-}
\ No newline at end of file
+  // The device stays open, so it can't be swapped for another one
+  parameters.io_method_name = "userptr";
+  ASSERT_THROW(m_test_cam->reconfigure(parameters), std::invalid_argument);
+}
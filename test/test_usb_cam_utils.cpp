@@ -29,6 +29,7 @@
 #include <gtest/gtest.h>
 #include <libavutil/pixfmt.h>
 
+#include <limits>
 #include <string>
 
 #include "usb_cam/utils.hpp"
@@ -69,9 +70,13 @@ TEST(test_usb_cam_utils, test_clip_value) {
     EXPECT_EQ(255, usb_cam::formats::CLIPVALUE(i));
   }
   // Test outlier cases val < -128 and val > 383
-  // these will use the old method (non-array method)
   EXPECT_EQ(0, usb_cam::formats::CLIPVALUE(-129));
   EXPECT_EQ(255, usb_cam::formats::CLIPVALUE(400));
+  EXPECT_EQ(0, usb_cam::formats::CLIPVALUE(std::numeric_limits<int>::min()));
+  EXPECT_EQ(255, usb_cam::formats::CLIPVALUE(std::numeric_limits<int>::max()));
+  // Usable at compile time
+  static_assert(usb_cam::formats::CLIPVALUE(-1) == 0, "CLIPVALUE(-1) should be 0");
+  static_assert(usb_cam::formats::CLIPVALUE(256) == 255, "CLIPVALUE(256) should be 255");
 }
 
 TEST(test_usb_cam_utils, test_monotonic_to_real_time) {
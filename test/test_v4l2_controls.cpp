@@ -0,0 +1,62 @@
+// Copyright 2023 Evan Flynn
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the Evan Flynn nor the names of its
+//      contributors may be used to endorse or promote products derived from
+//      this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "usb_cam/v4l2_controls.hpp"
+
+
+TEST(test_v4l2_controls, normalize_name) {
+  using usb_cam::V4l2Controls;
+  EXPECT_EQ(V4l2Controls::normalize_name("Brightness"), "brightness");
+  EXPECT_EQ(
+    V4l2Controls::normalize_name("White Balance, Automatic"), "white_balance_automatic");
+  EXPECT_EQ(V4l2Controls::normalize_name("Exposure Time, Absolute"), "exposure_time_absolute");
+  EXPECT_EQ(V4l2Controls::normalize_name("Focus (absolute)"), "focus_absolute");
+  EXPECT_EQ(
+    V4l2Controls::normalize_name("Power Line Frequency"), "power_line_frequency");
+  EXPECT_EQ(V4l2Controls::normalize_name("  Leading, trailing  "), "leading_trailing");
+  EXPECT_EQ(V4l2Controls::normalize_name(""), "");
+}
+
+TEST(test_v4l2_controls, unknown_controls_are_not_set) {
+  usb_cam::V4l2Controls controls;
+  EXPECT_EQ(controls.find("brightness"), nullptr);
+  EXPECT_EQ(controls.find("white_balance_temperature_auto"), nullptr);
+
+  // Nothing is sent to the device for controls it doesn't have
+  auto failed = controls.set(-1, {{"brightness", 128}, {"focus_auto", 1}});
+  ASSERT_EQ(failed.size(), 2U);
+  EXPECT_EQ(failed[0], "brightness");
+  EXPECT_EQ(failed[1], "focus_auto");
+
+  int64_t value = 0;
+  EXPECT_FALSE(controls.get(-1, "brightness", value));
+}